@@ -0,0 +1,867 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <R_ext/Riconv.h>
+#include "rcorpus.h"
+
+/*
+ * Parse a set of local Project Gutenberg plain-text files. The heavy
+ * lifting (mapping the file, finding the header and footer, transcoding,
+ * and repairing malformed UTF-8) happens on a pool of worker threads,
+ * which never call into R. The main thread copies the results into R
+ * objects, one batch at a time, so that the memory used by the
+ * intermediate buffers stays bounded.
+ */
+
+#define GUTENBERG_BATCH 256
+
+// U+FFFD REPLACEMENT CHARACTER
+#define REPLACEMENT_CHAR "\xEF\xBF\xBD"
+#define REPLACEMENT_SIZE 3
+
+
+struct line {
+	const uint8_t *ptr;
+	size_t size;
+};
+
+struct lines {
+	struct line *items;
+	size_t nitem;
+	size_t nitem_max;
+};
+
+struct buffer {
+	uint8_t *ptr;
+	size_t size;
+	size_t size_max;
+};
+
+struct book {
+	const char *path;
+	struct buffer title;
+	struct buffer author;
+	struct buffer language;
+	struct buffer text;
+	int has_title;
+	int has_author;
+	int has_language;
+	int err;
+	char message[256];
+};
+
+struct pool {
+	struct book *books;
+	int nbook;
+	int next;
+	pthread_mutex_t lock;
+};
+
+struct context {
+	struct book *books;
+	int nbook;
+};
+
+
+static void buffer_destroy(struct buffer *buf)
+{
+	corpus_free(buf->ptr);
+	buf->ptr = NULL;
+	buf->size = 0;
+	buf->size_max = 0;
+}
+
+
+static int buffer_reserve(struct buffer *buf, size_t extra)
+{
+	uint8_t *ptr;
+	size_t size_max;
+
+	if (buf->size_max - buf->size >= extra) {
+		return 0;
+	}
+
+	size_max = buf->size_max ? buf->size_max : 64;
+	while (size_max - buf->size < extra) {
+		if (size_max > SIZE_MAX / 2) {
+			return CORPUS_ERROR_OVERFLOW;
+		}
+		size_max *= 2;
+	}
+
+	if (!(ptr = corpus_realloc(buf->ptr, size_max))) {
+		return CORPUS_ERROR_NOMEM;
+	}
+
+	buf->ptr = ptr;
+	buf->size_max = size_max;
+	return 0;
+}
+
+
+static void book_clear(struct book *book)
+{
+	buffer_destroy(&book->title);
+	buffer_destroy(&book->author);
+	buffer_destroy(&book->language);
+	buffer_destroy(&book->text);
+}
+
+
+static void context_destroy(void *obj)
+{
+	struct context *ctx = obj;
+	int i;
+
+	for (i = 0; i < ctx->nbook; i++) {
+		book_clear(&ctx->books[i]);
+	}
+	corpus_free(ctx->books);
+}
+
+
+/*
+ * Return the length of the valid UTF-8 sequence starting at ptr, or
+ * 0 if the bytes at ptr do not start a valid sequence.
+ */
+static size_t utf8_seq_size(const uint8_t *ptr, const uint8_t *end)
+{
+	uint8_t ch = *ptr;
+	size_t i, size;
+	uint8_t lo = 0x80, hi = 0xBF;
+
+	if (ch < 0x80) {
+		return 1;
+	} else if (ch < 0xC2) {
+		return 0;
+	} else if (ch < 0xE0) {
+		size = 2;
+	} else if (ch < 0xF0) {
+		size = 3;
+		if (ch == 0xE0) {
+			lo = 0xA0; // overlong
+		} else if (ch == 0xED) {
+			hi = 0x9F; // surrogate
+		}
+	} else if (ch < 0xF5) {
+		size = 4;
+		if (ch == 0xF0) {
+			lo = 0x90; // overlong
+		} else if (ch == 0xF4) {
+			hi = 0x8F; // above U+10FFFF
+		}
+	} else {
+		return 0;
+	}
+
+	if ((size_t)(end - ptr) < size) {
+		return 0;
+	}
+	if (ptr[1] < lo || ptr[1] > hi) {
+		return 0;
+	}
+	for (i = 2; i < size; i++) {
+		if ((ptr[i] & 0xC0) != 0x80) {
+			return 0;
+		}
+	}
+	return size;
+}
+
+
+/*
+ * Append the bytes [ptr, end) to buf, normalizing line endings to "\n",
+ * dropping NUL characters, and replacing malformed UTF-8 with U+FFFD.
+ */
+static int buffer_append_repair(struct buffer *buf, const uint8_t *ptr,
+				const uint8_t *end)
+{
+	size_t size;
+	int err = 0;
+
+	// worst case: every byte gets replaced
+	if ((size_t)(end - ptr) > (SIZE_MAX - buf->size) / REPLACEMENT_SIZE) {
+		return CORPUS_ERROR_OVERFLOW;
+	}
+	TRY(buffer_reserve(buf, (size_t)(end - ptr) * REPLACEMENT_SIZE));
+
+	while (ptr != end) {
+		if (*ptr == '\0') {
+			ptr++;
+		} else if (*ptr == '\r') {
+			buf->ptr[buf->size++] = '\n';
+			ptr++;
+			if (ptr != end && *ptr == '\n') {
+				ptr++;
+			}
+		} else if ((size = utf8_seq_size(ptr, end))) {
+			memcpy(buf->ptr + buf->size, ptr, size);
+			buf->size += size;
+			ptr += size;
+		} else {
+			memcpy(buf->ptr + buf->size, REPLACEMENT_CHAR,
+			       REPLACEMENT_SIZE);
+			buf->size += REPLACEMENT_SIZE;
+			ptr++;
+		}
+	}
+out:
+	return err;
+}
+
+
+static int lines_split(struct lines *lines, const uint8_t *ptr, size_t size)
+{
+	const uint8_t *end = ptr + size;
+	const uint8_t *begin;
+	struct line *items;
+	size_t nmax;
+
+	lines->nitem = 0;
+
+	while (ptr != end) {
+		begin = ptr;
+		while (ptr != end && *ptr != '\n' && *ptr != '\r') {
+			ptr++;
+		}
+
+		if (lines->nitem == lines->nitem_max) {
+			nmax = lines->nitem_max ? 2 * lines->nitem_max : 1024;
+			items = corpus_realloc(lines->items,
+					       nmax * sizeof(*items));
+			if (!items) {
+				return CORPUS_ERROR_NOMEM;
+			}
+			lines->items = items;
+			lines->nitem_max = nmax;
+		}
+
+		lines->items[lines->nitem].ptr = begin;
+		lines->items[lines->nitem].size = (size_t)(ptr - begin);
+		lines->nitem++;
+
+		// skip the line terminator: "\r\n", "\n", or "\r"
+		if (ptr != end && *ptr == '\r') {
+			ptr++;
+		}
+		if (ptr != end && *ptr == '\n') {
+			ptr++;
+		}
+	}
+
+	return 0;
+}
+
+
+static const uint8_t *line_find(const uint8_t *ptr, const uint8_t *end,
+				const char *str)
+{
+	size_t len = strlen(str);
+
+	while ((size_t)(end - ptr) >= len) {
+		if (memcmp(ptr, str, len) == 0) {
+			return ptr;
+		}
+		ptr++;
+	}
+	return NULL;
+}
+
+
+static const uint8_t *line_find_nocase(const uint8_t *ptr,
+				       const uint8_t *end, const char *str)
+{
+	size_t i, len = strlen(str);
+	uint8_t ch;
+
+	while ((size_t)(end - ptr) >= len) {
+		for (i = 0; i < len; i++) {
+			ch = ptr[i];
+			if ('A' <= ch && ch <= 'Z') {
+				ch += 'a' - 'A';
+			}
+			if (ch != (uint8_t)str[i]) {
+				break;
+			}
+		}
+		if (i == len) {
+			return ptr;
+		}
+		ptr++;
+	}
+	return NULL;
+}
+
+
+static int line_starts(const struct line *line, const char *str)
+{
+	size_t len = strlen(str);
+	return (line->size >= len && memcmp(line->ptr, str, len) == 0);
+}
+
+
+// "^[*][*][*].*PROJECT GUTENBERG.*[*][*][*]|END.*SMALL PRINT"
+static int is_header_end(const struct line *line)
+{
+	const uint8_t *end = line->ptr + line->size;
+	const uint8_t *ptr;
+
+	if (line_starts(line, "***")) {
+		ptr = line_find(line->ptr + 3, end, "PROJECT GUTENBERG");
+		if (ptr && line_find(ptr + 17, end, "***")) {
+			return 1;
+		}
+	}
+
+	ptr = line_find(line->ptr, end, "END");
+	if (ptr && line_find(ptr + 3, end, "SMALL PRINT")) {
+		return 1;
+	}
+
+	return 0;
+}
+
+
+// "^End of .*Project Gutenberg.*|[*][*][*].*END OF.*PROJECT GUTENBERG"
+static int is_footer_start(const struct line *line)
+{
+	const uint8_t *end = line->ptr + line->size;
+	const uint8_t *ptr;
+
+	if (line_starts(line, "End of ")
+			&& line_find(line->ptr + 7, end, "Project Gutenberg")) {
+		return 1;
+	}
+
+	ptr = line_find(line->ptr, end, "***");
+	if (ptr && (ptr = line_find(ptr + 3, end, "END OF"))
+			&& line_find(ptr + 6, end, "PROJECT GUTENBERG")) {
+		return 1;
+	}
+
+	return 0;
+}
+
+
+static int is_note(const struct line *line)
+{
+	static const char *anywhere[] = { "produced by", "prepared by",
+		"transcribed from", "project gutenberg", NULL };
+	static const char *prefix[] = { "***", "note: ", "special thanks",
+		"this is a retranscription", NULL };
+	const uint8_t *end = line->ptr + line->size;
+	size_t len;
+	int i;
+
+	for (i = 0; anywhere[i]; i++) {
+		if (line_find_nocase(line->ptr, end, anywhere[i])) {
+			return 1;
+		}
+	}
+
+	for (i = 0; prefix[i]; i++) {
+		len = strlen(prefix[i]);
+		if (len <= line->size && line_find_nocase(line->ptr,
+						line->ptr + len, prefix[i])) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+static int is_space(uint8_t ch)
+{
+	return (ch == ' ' || ch == '\t' || ch == '\v' || ch == '\f');
+}
+
+
+/*
+ * Get the value of a "Field: value" line, with surrounding white space
+ * removed. If 'anchored' is zero, the field name can appear anywhere in
+ * the line.
+ */
+static int line_field(const struct line *line, const char *field,
+		      int anchored, struct line *value)
+{
+	const uint8_t *end = line->ptr + line->size;
+	const uint8_t *ptr;
+
+	if (anchored) {
+		if (!line_starts(line, field)) {
+			return 0;
+		}
+		ptr = line->ptr;
+	} else if (!(ptr = line_find(line->ptr, end, field))) {
+		return 0;
+	}
+
+	ptr += strlen(field);
+	while (ptr != end && is_space(*ptr)) {
+		ptr++;
+	}
+	while (end != ptr && is_space(end[-1])) {
+		end--;
+	}
+
+	value->ptr = ptr;
+	value->size = (size_t)(end - ptr);
+	return 1;
+}
+
+
+static int is_utf8_encoding(const struct line *enc)
+{
+	static const char *names[] = { "ascii", "us-ascii", "utf-8", "utf8",
+				       NULL };
+	size_t len;
+	int i;
+
+	for (i = 0; names[i]; i++) {
+		len = strlen(names[i]);
+		if (enc->size == len && line_find_nocase(enc->ptr,
+						enc->ptr + len, names[i])) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+/*
+ * Transcode [ptr, ptr + size) from the named encoding to UTF-8. Bytes
+ * that cannot be converted get replaced by U+FFFD.
+ */
+static int transcode(struct buffer *dst, const uint8_t *ptr, size_t size,
+		     const char *encoding)
+{
+	void *cd;
+	const char *inbuf = (const char *)ptr;
+	char *outbuf;
+	size_t inbytesleft = size, outbytesleft, status;
+	int err = 0;
+
+	// Riconv_open does not touch R's state unless one of the
+	// encoding names is empty, so it is safe to call from a worker
+	cd = Riconv_open("UTF-8", encoding);
+	if (cd == (void *)-1) {
+		return CORPUS_ERROR_INVAL;
+	}
+
+	dst->size = 0;
+	TRY(buffer_reserve(dst, size + size / 2 + 16));
+
+	while (inbytesleft > 0) {
+		outbuf = (char *)dst->ptr + dst->size;
+		outbytesleft = dst->size_max - dst->size;
+		status = Riconv(cd, &inbuf, &inbytesleft, &outbuf,
+				&outbytesleft);
+		dst->size = (size_t)((uint8_t *)outbuf - dst->ptr);
+
+		if (status != (size_t)-1) {
+			break;
+		}
+
+		if (errno == E2BIG) {
+			TRY(buffer_reserve(dst, inbytesleft + 16));
+		} else {
+			// EILSEQ or EINVAL: skip the offending byte
+			TRY(buffer_reserve(dst, REPLACEMENT_SIZE));
+			memcpy(dst->ptr + dst->size, REPLACEMENT_CHAR,
+			       REPLACEMENT_SIZE);
+			dst->size += REPLACEMENT_SIZE;
+			inbuf++;
+			inbytesleft--;
+		}
+	}
+
+out:
+	Riconv_close(cd);
+	return err;
+}
+
+
+static int book_field(struct buffer *dst, int *has, const struct lines *lines,
+		      size_t nline, const char *field)
+{
+	struct line value;
+	size_t i;
+
+	for (i = 0; i < nline; i++) {
+		if (line_field(&lines->items[i], field, 1, &value)) {
+			*has = 1;
+			dst->size = 0;
+			return buffer_append_repair(dst, value.ptr,
+						    value.ptr + value.size);
+		}
+	}
+
+	*has = 0;
+	return 0;
+}
+
+
+static int book_parse_buffer(struct book *book, const uint8_t *ptr,
+			     size_t size)
+{
+	struct lines lines;
+	struct buffer conv;
+	struct line value;
+	const struct line *items;
+	char encoding[64];
+	size_t i, n, start, end, note_end;
+	int err = 0;
+
+	memset(&lines, 0, sizeof(lines));
+	memset(&conv, 0, sizeof(conv));
+
+	TRY(lines_split(&lines, ptr, size));
+
+	// the header ends at the first "*** START ... PROJECT GUTENBERG"
+	start = 0;
+	for (i = 0; i < lines.nitem; i++) {
+		if (is_header_end(&lines.items[i])) {
+			start = i + 1;
+			break;
+		}
+	}
+
+	// transcode if the header declares a non-UTF-8 encoding
+	for (i = 0; i < start; i++) {
+		if (!line_field(&lines.items[i], "Character set encoding:", 0,
+				&value)) {
+			continue;
+		}
+		if (value.size > 0 && value.size < sizeof(encoding)
+				&& !is_utf8_encoding(&value)) {
+			memcpy(encoding, value.ptr, value.size);
+			encoding[value.size] = '\0';
+			if ((err = transcode(&conv, ptr, size, encoding))) {
+				snprintf(book->message, sizeof(book->message),
+					 "failed converting from encoding"
+					 " \"%s\"", encoding);
+				goto out;
+			}
+			TRY(lines_split(&lines, conv.ptr, conv.size));
+		}
+		break;
+	}
+
+	items = lines.items;
+	n = lines.nitem;
+
+	// metadata
+	TRY(book_field(&book->title, &book->has_title, &lines, start,
+		       "Title:"));
+	TRY(book_field(&book->author, &book->has_author, &lines, start,
+		       "Author:"));
+	TRY(book_field(&book->language, &book->has_language, &lines, start,
+		       "Language:"));
+
+	// skip leading empty lines
+	while (start < n && items[start].size == 0) {
+		start++;
+	}
+
+	// the footer starts at the first "End of ... Project Gutenberg"
+	end = n;
+	for (i = start; i < n; i++) {
+		if (is_footer_start(&items[i])) {
+			end = i;
+			break;
+		}
+	}
+
+	// skip trailing empty lines; 'end' is one past the last line
+	while (end > start && items[end - 1].size == 0) {
+		end--;
+	}
+
+	// skip production notes; each ends at the next empty line
+	while (start < end && is_note(&items[start])) {
+		note_end = start;
+		while (note_end < n && items[note_end].size > 0) {
+			note_end++;
+		}
+		if (note_end == n) {
+			break;
+		}
+		start = note_end;
+		while (start < n && items[start].size == 0) {
+			start++;
+		}
+	}
+
+	book->text.size = 0;
+	if (start < end) {
+		TRY(buffer_append_repair(&book->text, items[start].ptr,
+					 items[end - 1].ptr
+					 + items[end - 1].size));
+	}
+
+	if (book->text.size > INT_MAX) {
+		snprintf(book->message, sizeof(book->message),
+			 "text size (%"PRIu64" bytes) exceeds maximum (%d)",
+			 (uint64_t)book->text.size, INT_MAX);
+		err = CORPUS_ERROR_OVERFLOW;
+		goto out;
+	}
+
+out:
+	buffer_destroy(&conv);
+	corpus_free(lines.items);
+	return err;
+}
+
+
+static void book_parse(struct book *book)
+{
+	struct corpus_filebuf buf;
+	int err;
+
+	errno = 0;
+	if (corpus_filebuf_init(&buf, book->path)) {
+		book->err = CORPUS_ERROR_OS;
+		if (errno) {
+			snprintf(book->message, sizeof(book->message),
+				 "cannot open file: %s", strerror(errno));
+		} else {
+			snprintf(book->message, sizeof(book->message),
+				 "cannot open file");
+		}
+		return;
+	}
+
+	err = book_parse_buffer(book, buf.map_addr, buf.map_size);
+	corpus_filebuf_destroy(&buf);
+
+	if (err) {
+		book->err = err;
+		if (!book->message[0]) {
+			snprintf(book->message, sizeof(book->message),
+				 "%s", err == CORPUS_ERROR_NOMEM
+				 ? "failed allocating memory"
+				 : "failed parsing file");
+		}
+		book_clear(book);
+	}
+}
+
+
+static void *pool_work(void *arg)
+{
+	struct pool *pool = arg;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&pool->lock);
+		i = pool->next++;
+		pthread_mutex_unlock(&pool->lock);
+
+		if (i >= pool->nbook) {
+			break;
+		}
+
+		TRACE_BEGIN("gutenberg:parse");
+		book_parse(&pool->books[i]);
+		TRACE_END("gutenberg:parse");
+	}
+
+	return NULL;
+}
+
+
+static void pool_run(struct book *books, int nbook, int nthread)
+{
+	pthread_t *threads;
+	struct pool pool;
+	int t, nstarted = 0;
+
+	pool.books = books;
+	pool.nbook = nbook;
+	pool.next = 0;
+	pthread_mutex_init(&pool.lock, NULL);
+
+	if (nthread > nbook) {
+		nthread = nbook;
+	}
+
+	// the calling thread is one of the workers
+	threads = (void *)R_alloc(nthread > 1 ? nthread - 1 : 1,
+				  sizeof(*threads));
+	for (t = 0; t < nthread - 1; t++) {
+		if (pthread_create(&threads[t], NULL, pool_work, &pool)) {
+			break; // proceed with fewer threads
+		}
+		nstarted++;
+	}
+
+	pool_work(&pool);
+
+	for (t = 0; t < nstarted; t++) {
+		pthread_join(threads[t], NULL);
+	}
+
+	pthread_mutex_destroy(&pool.lock);
+}
+
+
+static SEXP mkchar_buffer(const struct buffer *buf, int has)
+{
+	if (!has) {
+		return NA_STRING;
+	}
+	return mkCharLenCE((const char *)buf->ptr, (int)buf->size, CE_UTF8);
+}
+
+
+SEXP gutenberg_read_files(SEXP spaths, SEXP sthreads)
+{
+	SEXP ans, sctx, names, title, author, language, text, sources,
+	     source, row, start, stop, raw;
+	struct context *ctx;
+	struct book *book;
+	const char **paths, *path;
+	char *copy;
+	R_xlen_t n;
+	int i, b, off, nthread, nbatch, nprot = 0;
+
+	if (TYPEOF(spaths) != STRSXP) {
+		error("invalid 'paths' argument");
+	}
+	n = XLENGTH(spaths);
+	if (n > INT_MAX) {
+		error("'paths' length exceeds maximum (%d)", INT_MAX);
+	}
+
+	if (sthreads == R_NilValue) {
+		nthread = default_threads();
+	} else {
+		nthread = INTEGER(sthreads)[0];
+		if (nthread == NA_INTEGER || nthread < 1) {
+			error("invalid 'threads' argument");
+		}
+	}
+
+	// translate the file names on the main thread
+	paths = (void *)R_alloc(n ? n : 1, sizeof(*paths));
+	for (i = 0; i < n; i++) {
+		if (STRING_ELT(spaths, i) == NA_STRING) {
+			error("'paths' element at index %d is NA", i + 1);
+		}
+		// R_ExpandFileName may return a static buffer, so copy it
+		path = R_ExpandFileName(translateChar(STRING_ELT(spaths, i)));
+		copy = R_alloc(strlen(path) + 1, 1);
+		strcpy(copy, path);
+		paths[i] = copy;
+	}
+
+	PROTECT(title = allocVector(STRSXP, n)); nprot++;
+	PROTECT(author = allocVector(STRSXP, n)); nprot++;
+	PROTECT(language = allocVector(STRSXP, n)); nprot++;
+	PROTECT(sources = allocVector(VECSXP, n)); nprot++;
+	PROTECT(source = allocVector(INTSXP, n)); nprot++;
+	PROTECT(row = allocVector(REALSXP, n)); nprot++;
+	PROTECT(start = allocVector(INTSXP, n)); nprot++;
+	PROTECT(stop = allocVector(INTSXP, n)); nprot++;
+
+	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy)); nprot++;
+	ctx = as_context(sctx);
+	if (!(ctx->books = corpus_calloc(GUTENBERG_BATCH,
+					 sizeof(*ctx->books)))) {
+		error("failed allocating memory");
+	}
+
+	for (off = 0; off < n; off += GUTENBERG_BATCH) {
+		R_CheckUserInterrupt();
+
+		nbatch = (int)(n - off < GUTENBERG_BATCH
+			       ? n - off : GUTENBERG_BATCH);
+		memset(ctx->books, 0, nbatch * sizeof(*ctx->books));
+		for (b = 0; b < nbatch; b++) {
+			ctx->books[b].path = paths[off + b];
+		}
+		ctx->nbook = nbatch;
+
+		pool_run(ctx->books, nbatch, nthread);
+
+		for (b = 0; b < nbatch; b++) {
+			book = &ctx->books[b];
+			i = off + b;
+
+			SET_STRING_ELT(title, i, mkchar_buffer(&book->title,
+							book->has_title));
+			SET_STRING_ELT(author, i, mkchar_buffer(&book->author,
+							book->has_author));
+			SET_STRING_ELT(language, i,
+				       mkchar_buffer(&book->language,
+						     book->has_language));
+
+			raw = allocVector(RAWSXP, book->text.size);
+			SET_VECTOR_ELT(sources, i, raw);
+			if (book->text.size) {
+				memcpy(RAW(raw), book->text.ptr,
+				       book->text.size);
+			}
+			book_clear(book);
+
+			INTEGER(source)[i] = i + 1;
+			REAL(row)[i] = 1;
+			if (book->err) {
+				INTEGER(start)[i] = NA_INTEGER;
+				INTEGER(stop)[i] = NA_INTEGER;
+				warning("failed reading file \"%s\": %s",
+					book->path, book->message);
+			} else {
+				INTEGER(start)[i] = 1;
+				INTEGER(stop)[i] = (int)XLENGTH(raw);
+			}
+		}
+
+		ctx->nbook = 0;
+	}
+
+	free_context(sctx);
+
+	PROTECT(text = alloc_text(sources, source, row, start, stop,
+				  R_NilValue, R_NilValue)); nprot++;
+
+	PROTECT(ans = allocVector(VECSXP, 4)); nprot++;
+	SET_VECTOR_ELT(ans, 0, title);
+	SET_VECTOR_ELT(ans, 1, author);
+	SET_VECTOR_ELT(ans, 2, language);
+	SET_VECTOR_ELT(ans, 3, text);
+
+	PROTECT(names = allocVector(STRSXP, 4)); nprot++;
+	SET_STRING_ELT(names, 0, mkChar("title"));
+	SET_STRING_ELT(names, 1, mkChar("author"));
+	SET_STRING_ELT(names, 2, mkChar("language"));
+	SET_STRING_ELT(names, 3, mkChar("text"));
+	setAttrib(ans, R_NamesSymbol, names);
+
+	UNPROTECT(nprot);
+	return ans;
+}
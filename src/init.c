@@ -36,38 +36,59 @@ static const R_CallMethodDef CallEntries[] = {
 	CALLDEF(as_text_filter_connector, 1),
 	CALLDEF(as_text_json, 2),
 	CALLDEF(dim_json, 1),
+	CALLDEF(gutenberg_read_files, 2),
 	CALLDEF(is_na_text, 1),
 	CALLDEF(length_json, 1),
 	CALLDEF(length_text, 1),
 	CALLDEF(logging_off, 0),
 	CALLDEF(logging_on, 0),
-	CALLDEF(mmap_ndjson, 2),
+	CALLDEF(mmap_ndjson, 3),
 	CALLDEF(names_json, 1),
 	CALLDEF(names_text, 1),
 	CALLDEF(print_json, 1),
-	CALLDEF(read_ndjson, 2),
+	CALLDEF(read_ndjson, 3),
 	CALLDEF(simplify_json, 1),
 	CALLDEF(stem_snowball, 2),
 	CALLDEF(stopwords, 1),
 	CALLDEF(subscript_json, 2),
 	CALLDEF(subset_json, 3),
-	CALLDEF(term_stats, 7),
-	CALLDEF(term_matrix, 4),
+	CALLDEF(term_stats, 12),
+	CALLDEF(term_stats_ndjson, 11),
+	CALLDEF(term_matrix, 6),
 	CALLDEF(text_c, 3),
+	CALLDEF(text_compare, 3),
 	CALLDEF(text_count, 2),
 	CALLDEF(text_detect, 2),
+	CALLDEF(text_detect_ndjson, 5),
+	CALLDEF(text_duplicated, 3),
+	CALLDEF(text_filter_attach, 3),
+	CALLDEF(text_filter_patch, 2),
+	CALLDEF(text_filter_read, 1),
+	CALLDEF(text_filter_types, 1),
+	CALLDEF(text_filter_write, 4),
+	CALLDEF(text_index, 1),
 	CALLDEF(text_locate, 2),
+	CALLDEF(text_lookup, 3),
 	CALLDEF(text_match, 2),
 	CALLDEF(text_nsentence, 1),
 	CALLDEF(text_ntoken, 1),
 	CALLDEF(text_ntype, 2),
+	CALLDEF(text_order, 4),
+	CALLDEF(text_pack, 1),
+	CALLDEF(text_rank, 6),
+	CALLDEF(text_seal, 1),
+	CALLDEF(text_sealed, 1),
 	CALLDEF(text_split_sentences, 2),
 	CALLDEF(text_split_tokens, 2),
 	CALLDEF(text_sub, 3),
 	CALLDEF(text_trunc, 3),
 	CALLDEF(text_tokens, 1),
 	CALLDEF(text_types, 2),
+	CALLDEF(text_untoken, 3),
 	CALLDEF(text_valid, 1),
+	CALLDEF(text_xtfrm, 2),
+	CALLDEF(trace_start, 0),
+	CALLDEF(trace_stop, 1),
         {NULL, NULL, 0}
 };
 
@@ -77,4 +98,7 @@ void R_init_corpus(DllInfo *dll)
 	R_registerRoutines(dll, NULL, CallEntries, NULL, NULL);
 	R_useDynamicSymbols(dll, FALSE);
 	R_forceSymbols(dll, TRUE);
+
+	init_split_altrep(dll);
+	init_tokens_altrep(dll);
 }
@@ -138,11 +138,63 @@ out:
 }
 
 
-static void json_load(SEXP sdata)
+struct context {
+	struct json_layouts layouts;
+	int has_layouts;
+};
+
+
+static void context_destroy(void *obj)
+{
+	struct context *ctx = obj;
+
+	if (ctx->has_layouts) {
+		json_layouts_destroy(&ctx->layouts);
+	}
+}
+
+
+/*
+ * With a positive 'sample', the first 'sample' rows go through
+ * corpus_data_assign, and we learn their record layouts. After that,
+ * rows with a known layout get their type without the general inference;
+ * the rest fall back to corpus_data_assign.
+ */
+static int load_row(struct json *parent, struct context *ctx,
+		    R_xlen_t nrow, int sample, const uint8_t *ptr,
+		    size_t size, int *type_idptr)
+{
+	struct corpus_data *data = &parent->rows[nrow];
+	int id = -1, err = 0;
+
+	if (ctx->has_layouts && nrow >= sample) {
+		TRY(json_layouts_match(&ctx->layouts, ptr, size, data, &id));
+	}
+
+	if (id < 0) {
+		TRY(corpus_data_assign(data, &parent->schema, ptr, size));
+		TRY(corpus_schema_union(&parent->schema, *type_idptr,
+					data->type_id, type_idptr));
+
+		if (ctx->has_layouts && nrow < sample) {
+			TRY(json_layouts_learn(&ctx->layouts, ptr, size, data,
+					       &id));
+		}
+	}
+
+	// a matching row has the type of the row we learned the layout
+	// from, which is already part of the union
+out:
+	return err;
+}
+
+
+static void json_load(SEXP sdata, int sample)
 {
 	SEXP shandle, sparent_handle, sbuffer, sfield, stext, sfield_path,
-	     srows, sparent, sparent2;
+	     srows, sparent, sparent2, sctx;
 	struct json *obj, *parent;
+	struct context *ctx;
 	struct corpus_filebuf *buf;
 	struct corpus_filebuf_iter it;
 	const uint8_t *ptr, *begin, *line_end, *end;
@@ -157,11 +209,20 @@ static void json_load(SEXP sdata)
 		return;
 	}
 
+	TRACE_BEGIN("json_load");
+
 	// set up the finalizer
 	R_RegisterCFinalizerEx(shandle, free_json, TRUE);
 
 	sbuffer = getListElement(sdata, "buffer");
 	stext = getListElement(sdata, "text");
+	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy));
+	ctx = as_context(sctx);
+	if (sample > 0) {
+		json_layouts_init(&ctx->layouts);
+		ctx->has_layouts = 1;
+	}
+
 	PROTECT(sparent = alloc_json(sbuffer, R_NilValue, R_NilValue, stext));
 	sparent_handle = getListElement(sparent, "handle");
 	parent = R_ExternalPtrAddr(sparent_handle);
@@ -184,12 +245,8 @@ static void json_load(SEXP sdata)
 			ptr = it.current.ptr;
 			size = it.current.size;
 
-			TRY(corpus_data_assign(&parent->rows[nrow],
-					       &parent->schema, ptr, size));
-
-			TRY(corpus_schema_union(&parent->schema, type_id,
-						parent->rows[nrow].type_id,
-						&type_id));
+			TRY(load_row(parent, ctx, nrow, sample, ptr, size,
+				     &type_id));
 			nrow++;
 		}
 	} else {
@@ -212,12 +269,8 @@ static void json_load(SEXP sdata)
 
 			size = (size_t)(line_end - ptr);
 
-			TRY(corpus_data_assign(&parent->rows[nrow],
-					       &parent->schema, ptr, size));
-
-			TRY(corpus_schema_union(&parent->schema, type_id,
-						parent->rows[nrow].type_id,
-						&type_id));
+			TRY(load_row(parent, ctx, nrow, sample, ptr, size,
+				     &type_id));
 			nrow++;
 			ptr = line_end;
 		}
@@ -264,9 +317,11 @@ static void json_load(SEXP sdata)
 	R_SetExternalPtrAddr(shandle, obj);
 
 out:
+	TRACE_END("json_load");
 	CHECK_ERROR_FORMAT(err, "failed parsing row %"PRIu64" of JSON data",
 			   (uint64_t)(nrow + 1));
-	UNPROTECT(1);
+	free_context(sctx);
+	UNPROTECT(2);
 }
 
 
@@ -294,6 +349,12 @@ int is_json(SEXP sdata)
 
 
 struct json *as_json(SEXP sdata)
+{
+	return load_json(sdata, 0);
+}
+
+
+struct json *load_json(SEXP sdata, int sample)
 {
 	SEXP shandle;
 	struct json *obj;
@@ -302,7 +363,7 @@ struct json *as_json(SEXP sdata)
 		error("invalid JSON object");
 	}
 
-	json_load(sdata);
+	json_load(sdata, sample);
 
 	shandle = getListElement(sdata, "handle");
 	obj = R_ExternalPtrAddr(shandle);
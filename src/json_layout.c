@@ -0,0 +1,405 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "rcorpus.h"
+
+/*
+ * Record layouts let us skip the general type inference for NDJSON rows
+ * that look like rows we have already seen. A layout is the sequence of
+ * (field kind, field name) pairs of a flat record: one whose field values
+ * are all null, boolean, number, or string. We encode it as a signature
+ * string, with each field as a kind byte followed by the raw name and a
+ * closing quote; names with escapes never match, so the quote is
+ * unambiguous.
+ *
+ * We learn the layouts and their type ids from rows parsed by
+ * corpus_data_assign. A later row with the same signature gets the same
+ * type id without the schema lookups. The scanner only accepts the strict
+ * JSON grammar, and it gives up on anything else (nested values, escaped
+ * names, long integers, non-finite numbers); those rows go through the
+ * general path, which also reports any errors.
+ */
+
+// integers with at most this many digits are certain to fit in an int
+#define JSON_LAYOUT_INT_DIGITS 9
+
+#define IS_SPACE(ch) \
+	((ch) == ' ' || (ch) == '\t' || (ch) == '\n' || (ch) == '\r')
+
+
+static const uint8_t *scan_spaces(const uint8_t *ptr, const uint8_t *end)
+{
+	while (ptr != end && IS_SPACE(*ptr)) {
+		ptr++;
+	}
+	return ptr;
+}
+
+
+static const uint8_t *scan_literal(const uint8_t *ptr, const uint8_t *end,
+				   const char *lit)
+{
+	size_t len = strlen(lit);
+
+	if ((size_t)(end - ptr) < len || memcmp(ptr, lit, len) != 0) {
+		return NULL;
+	}
+	return ptr + len;
+}
+
+
+// scan a string, after the opening quote; set 'esc' if it has escapes
+static const uint8_t *scan_string(const uint8_t *ptr, const uint8_t *end,
+				  int *escptr)
+{
+	struct utf8lite_text text;
+	const uint8_t *begin = ptr;
+	int esc = 0;
+
+	while (ptr != end && *ptr != '"') {
+		if (*ptr < 0x20) {
+			return NULL;
+		}
+		if (*ptr == '\\') {
+			esc = 1;
+			ptr++;
+			if (ptr == end) {
+				return NULL;
+			}
+		}
+		ptr++;
+	}
+	if (ptr == end) {
+		return NULL;
+	}
+
+	if (utf8lite_text_assign(&text, begin, (size_t)(ptr - begin),
+				 UTF8LITE_TEXT_UNESCAPE, NULL)) {
+		return NULL;
+	}
+
+	*escptr = esc;
+	return ptr + 1;
+}
+
+
+static const uint8_t *scan_digits(const uint8_t *ptr, const uint8_t *end,
+				  int *ndigitptr)
+{
+	int ndigit = 0;
+
+	while (ptr != end && '0' <= *ptr && *ptr <= '9') {
+		ptr++;
+		ndigit++;
+	}
+	*ndigitptr = ndigit;
+	return ptr;
+}
+
+
+static const uint8_t *scan_number(const uint8_t *ptr, const uint8_t *end,
+				  int *kindptr)
+{
+	int kind = CORPUS_DATATYPE_INTEGER;
+	int ndigit;
+
+	if (ptr != end && *ptr == '-') {
+		ptr++;
+	}
+
+	if (ptr != end && *ptr == '0') {
+		ptr++;
+		ndigit = 1;
+		if (ptr != end && '0' <= *ptr && *ptr <= '9') {
+			return NULL;
+		}
+	} else {
+		ptr = scan_digits(ptr, end, &ndigit);
+		if (ndigit == 0 || ndigit > JSON_LAYOUT_INT_DIGITS) {
+			return NULL;
+		}
+	}
+
+	if (ptr != end && *ptr == '.') {
+		kind = CORPUS_DATATYPE_REAL;
+		ptr = scan_digits(ptr + 1, end, &ndigit);
+		if (ndigit == 0) {
+			return NULL;
+		}
+	}
+
+	if (ptr != end && (*ptr == 'e' || *ptr == 'E')) {
+		kind = CORPUS_DATATYPE_REAL;
+		ptr++;
+		if (ptr != end && (*ptr == '+' || *ptr == '-')) {
+			ptr++;
+		}
+		ptr = scan_digits(ptr, end, &ndigit);
+		if (ndigit == 0) {
+			return NULL;
+		}
+	}
+
+	*kindptr = kind;
+	return ptr;
+}
+
+
+static const uint8_t *scan_value(const uint8_t *ptr, const uint8_t *end,
+				 int *kindptr)
+{
+	int esc;
+
+	if (ptr == end) {
+		return NULL;
+	}
+
+	switch (*ptr) {
+	case 'n':
+		*kindptr = CORPUS_DATATYPE_NULL;
+		return scan_literal(ptr, end, "null");
+	case 't':
+		*kindptr = CORPUS_DATATYPE_BOOLEAN;
+		return scan_literal(ptr, end, "true");
+	case 'f':
+		*kindptr = CORPUS_DATATYPE_BOOLEAN;
+		return scan_literal(ptr, end, "false");
+	case '"':
+		*kindptr = CORPUS_DATATYPE_TEXT;
+		return scan_string(ptr + 1, end, &esc);
+	default:
+		return scan_number(ptr, end, kindptr);
+	}
+}
+
+
+static int sig_append(struct json_layouts *l, const uint8_t *ptr,
+		      size_t size)
+{
+	uint8_t *sig;
+	size_t max;
+	int err = 0;
+
+	if (l->sig_size + size > l->sig_max) {
+		max = l->sig_max ? l->sig_max : 256;
+		while (l->sig_size + size > max) {
+			max *= 2;
+		}
+		TRY_ALLOC(sig = corpus_realloc(l->sig, max));
+		l->sig = sig;
+		l->sig_max = max;
+	}
+
+	memcpy(l->sig + l->sig_size, ptr, size);
+	l->sig_size += size;
+out:
+	return err;
+}
+
+
+// compute the signature of a row into l->sig, and the bounds of the
+// record into l->begin and l->end; set *okptr to 0 if the row is not a
+// flat record or if we cannot tell
+static int layout_scan(struct json_layouts *l, const uint8_t *ptr,
+		       size_t size, int *okptr)
+{
+	const uint8_t *end = ptr + size, *name, *name_end;
+	uint8_t kind_byte;
+	int kind, esc, err = 0;
+
+	*okptr = 0;
+	l->sig_size = 0;
+
+	ptr = scan_spaces(ptr, end);
+	if (ptr == end || *ptr != '{') {
+		goto out;
+	}
+	l->begin = ptr;
+	ptr = scan_spaces(ptr + 1, end);
+
+	if (ptr != end && *ptr == '}') {
+		ptr++;
+		goto close;
+	}
+
+	for (;;) {
+		if (ptr == end || *ptr != '"') {
+			goto out;
+		}
+		name = ptr + 1;
+		if (!(ptr = scan_string(name, end, &esc)) || esc) {
+			goto out;
+		}
+		name_end = ptr;
+
+		ptr = scan_spaces(ptr, end);
+		if (ptr == end || *ptr != ':') {
+			goto out;
+		}
+		ptr = scan_spaces(ptr + 1, end);
+
+		if (!(ptr = scan_value(ptr, end, &kind))) {
+			goto out;
+		}
+
+		// kind byte, then the name with its closing quote
+		kind_byte = (uint8_t)('0' + kind);
+		TRY(sig_append(l, &kind_byte, 1));
+		TRY(sig_append(l, name, (size_t)(name_end - name)));
+
+		ptr = scan_spaces(ptr, end);
+		if (ptr != end && *ptr == ',') {
+			ptr = scan_spaces(ptr + 1, end);
+			continue;
+		}
+		if (ptr != end && *ptr == '}') {
+			ptr++;
+			break;
+		}
+		goto out;
+	}
+
+close:
+	l->end = ptr;
+	if (scan_spaces(ptr, end) == end) {
+		*okptr = 1;
+	}
+out:
+	return err;
+}
+
+
+void json_layouts_init(struct json_layouts *l)
+{
+	memset(l, 0, sizeof(*l));
+}
+
+
+void json_layouts_destroy(struct json_layouts *l)
+{
+	int i;
+
+	for (i = 0; i < l->nlayout; i++) {
+		corpus_free(l->layout[i].sig);
+	}
+	corpus_free(l->sig);
+}
+
+
+static int layout_find(const struct json_layouts *l)
+{
+	const struct json_layout *layout;
+	int i;
+
+	for (i = 0; i < l->nlayout; i++) {
+		layout = &l->layout[i];
+		if (layout->type_id < 0) {
+			continue;
+		}
+		if (layout->size == l->sig_size && (l->sig_size == 0
+				|| !memcmp(layout->sig, l->sig, l->sig_size))) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+int json_layouts_match(struct json_layouts *l, const uint8_t *ptr,
+		       size_t size, struct corpus_data *data, int *idptr)
+{
+	const struct json_layout *layout;
+	int i, ok, err = 0;
+
+	*idptr = -1;
+
+	if (l->nlayout == 0) {
+		goto out;
+	}
+
+	TRY(layout_scan(l, ptr, size, &ok));
+	if (!ok || (i = layout_find(l)) < 0) {
+		goto out;
+	}
+
+	layout = &l->layout[i];
+	if (layout->trim) {
+		data->ptr = l->begin;
+		data->size = (size_t)(l->end - l->begin);
+	} else {
+		data->ptr = ptr;
+		data->size = size;
+	}
+	data->type_id = layout->type_id;
+	*idptr = i;
+out:
+	return err;
+}
+
+
+int json_layouts_learn(struct json_layouts *l, const uint8_t *ptr,
+		       size_t size, const struct corpus_data *data,
+		       int *idptr)
+{
+	struct json_layout *layout;
+	int i, ok, trim, err = 0;
+
+	*idptr = -1;
+
+	if (l->nlayout == JSON_LAYOUT_MAX) {
+		goto out;
+	}
+
+	TRY(layout_scan(l, ptr, size, &ok));
+	if (!ok) {
+		goto out;
+	}
+
+	if ((i = layout_find(l)) >= 0) {
+		// an equal signature should mean an equal type; if not, stop
+		// using the layout rather than guess
+		if (l->layout[i].type_id != data->type_id) {
+			l->layout[i].type_id = -1;
+		} else {
+			*idptr = i;
+		}
+		goto out;
+	}
+
+	// copy the way the general path delimits the row
+	if (data->ptr == ptr && data->size == size) {
+		trim = 0;
+	} else if (data->ptr == l->begin
+			&& data->size == (size_t)(l->end - l->begin)) {
+		trim = 1;
+	} else {
+		goto out;
+	}
+
+	layout = &l->layout[l->nlayout];
+	TRY_ALLOC(layout->sig = corpus_malloc(l->sig_size ? l->sig_size : 1));
+	memcpy(layout->sig, l->sig, l->sig_size);
+	layout->size = l->sig_size;
+	layout->type_id = data->type_id;
+	layout->trim = trim;
+	*idptr = l->nlayout;
+	l->nlayout++;
+out:
+	return err;
+}
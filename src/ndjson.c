@@ -18,27 +18,33 @@
 #include "rcorpus.h"
 
 
-SEXP mmap_ndjson(SEXP sfile, SEXP stext)
+static int sample_rows(SEXP ssample)
+{
+	return (ssample == R_NilValue) ? 0 : INTEGER(ssample)[0];
+}
+
+
+SEXP mmap_ndjson(SEXP sfile, SEXP stext, SEXP ssample)
 {
 	SEXP ans, sbuf;
 
 	PROTECT(sbuf = alloc_filebuf(sfile));
 	PROTECT(ans = alloc_json(sbuf, R_NilValue, R_NilValue, stext));
-	as_json(ans); // force data load
+	load_json(ans, sample_rows(ssample)); // force data load
 	UNPROTECT(2);
 
 	return ans;
 }
 
 
-SEXP read_ndjson(SEXP sbuffer, SEXP stext)
+SEXP read_ndjson(SEXP sbuffer, SEXP stext, SEXP ssample)
 {
 	SEXP ans;
 
 	assert(TYPEOF(sbuffer) == RAWSXP);
 
 	PROTECT(ans = alloc_json(sbuffer, R_NilValue, R_NilValue, stext));
-	as_json(ans); // force data load
+	load_json(ans, sample_rows(ssample)); // force data load
 	UNPROTECT(1);
 
 	return ans;
@@ -0,0 +1,740 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "rcorpus.h"
+
+/*
+ * Pipelined NDJSON reading. A reader thread reads the file in blocks and
+ * splits them at line boundaries; a pool of extractor threads finds the
+ * requested field in each line; and the caller, on the main thread,
+ * receives the blocks in file order, with one text per line. The blocks
+ * pass through bounded queues, so the memory in use is at most about
+ * 'depth' blocks, however large the file.
+ *
+ * None of the threads call into R. Closing the pipeline stops and joins
+ * the threads, so it is safe to do from a context finalizer after an R
+ * error on the main thread.
+ */
+
+#define PIPELINE_BLOCK_SIZE (1024 * 1024)
+
+
+/* bounded queues */
+
+struct queue {
+	void **items;
+	int capacity;
+	int head;
+	int count;
+	int closed;
+	pthread_mutex_t lock;
+	pthread_cond_t not_empty;
+	pthread_cond_t not_full;
+};
+
+
+int queue_open(struct queue **qptr, int capacity)
+{
+	struct queue *q;
+
+	if (!(q = corpus_calloc(1, sizeof(*q)))) {
+		return CORPUS_ERROR_NOMEM;
+	}
+	if (!(q->items = corpus_calloc((size_t)capacity, sizeof(*q->items)))) {
+		corpus_free(q);
+		return CORPUS_ERROR_NOMEM;
+	}
+	q->capacity = capacity;
+	pthread_mutex_init(&q->lock, NULL);
+	pthread_cond_init(&q->not_empty, NULL);
+	pthread_cond_init(&q->not_full, NULL);
+
+	*qptr = q;
+	return 0;
+}
+
+
+void queue_free(struct queue *q)
+{
+	if (!q) {
+		return;
+	}
+	pthread_cond_destroy(&q->not_full);
+	pthread_cond_destroy(&q->not_empty);
+	pthread_mutex_destroy(&q->lock);
+	corpus_free(q->items);
+	corpus_free(q);
+}
+
+
+// block until there is room; return non-zero if the queue got closed
+int queue_push(struct queue *q, void *item)
+{
+	int closed;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->count == q->capacity && !q->closed) {
+		pthread_cond_wait(&q->not_full, &q->lock);
+	}
+	closed = q->closed;
+	if (!closed) {
+		q->items[(q->head + q->count) % q->capacity] = item;
+		q->count++;
+		pthread_cond_signal(&q->not_empty);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return closed;
+}
+
+
+// block until there is an item; return zero once the queue is closed
+// and empty
+int queue_pop(struct queue *q, void **itemptr)
+{
+	int has;
+
+	pthread_mutex_lock(&q->lock);
+	while (q->count == 0 && !q->closed) {
+		pthread_cond_wait(&q->not_empty, &q->lock);
+	}
+	has = (q->count > 0);
+	if (has) {
+		*itemptr = q->items[q->head];
+		q->head = (q->head + 1) % q->capacity;
+		q->count--;
+		pthread_cond_signal(&q->not_full);
+	}
+	pthread_mutex_unlock(&q->lock);
+
+	return has;
+}
+
+
+void queue_close(struct queue *q)
+{
+	pthread_mutex_lock(&q->lock);
+	q->closed = 1;
+	pthread_cond_broadcast(&q->not_empty);
+	pthread_cond_broadcast(&q->not_full);
+	pthread_mutex_unlock(&q->lock);
+}
+
+
+/* blocks */
+
+struct block {
+	struct ndjson_batch batch;
+	uint8_t *data;
+	size_t size;
+	struct utf8lite_text *text;
+	R_xlen_t ntext_max;
+	int done;
+	int err;
+	char message[256];
+};
+
+struct ndjson_pipeline {
+	FILE *file;
+	char *field;
+	size_t field_size;
+
+	struct queue *work;
+	struct queue *ordered;
+	struct block *current;
+
+	pthread_t reader;
+	pthread_t *extractors;
+	int has_reader;
+	int nextractor;
+
+	pthread_mutex_t lock;
+	pthread_cond_t done;
+	int abort;
+	int err;
+	char message[256];
+};
+
+
+static void block_free(struct block *b)
+{
+	if (b) {
+		corpus_free(b->text);
+		corpus_free(b->data);
+		corpus_free(b);
+	}
+}
+
+
+static int block_add_text(struct block *b, const struct utf8lite_text *text)
+{
+	struct utf8lite_text *items;
+	R_xlen_t max;
+
+	if (b->batch.ntext == b->ntext_max) {
+		max = b->ntext_max ? 2 * b->ntext_max : 256;
+		items = corpus_realloc(b->text, (size_t)max * sizeof(*items));
+		if (!items) {
+			return CORPUS_ERROR_NOMEM;
+		}
+		b->text = items;
+		b->ntext_max = max;
+	}
+
+	b->text[b->batch.ntext++] = *text;
+	return 0;
+}
+
+
+/* field extraction */
+
+#define IS_SPACE(ch) \
+	((ch) == ' ' || (ch) == '\t' || (ch) == '\n' || (ch) == '\r')
+
+
+static const uint8_t *skip_spaces(const uint8_t *ptr, const uint8_t *end)
+{
+	while (ptr != end && IS_SPACE(*ptr)) {
+		ptr++;
+	}
+	return ptr;
+}
+
+
+// skip a string, after the opening quote; set 'esc' if it has escapes
+static const uint8_t *skip_string(const uint8_t *ptr, const uint8_t *end,
+				  int *escptr)
+{
+	int esc = 0;
+
+	while (ptr != end && *ptr != '"') {
+		if (*ptr == '\\') {
+			esc = 1;
+			if (++ptr == end) {
+				return NULL;
+			}
+		}
+		ptr++;
+	}
+	if (escptr) {
+		*escptr = esc;
+	}
+	return (ptr == end) ? NULL : ptr + 1;
+}
+
+
+static const uint8_t *skip_value(const uint8_t *ptr, const uint8_t *end)
+{
+	int depth = 0;
+
+	do {
+		if (ptr == end) {
+			return NULL;
+		}
+		switch (*ptr) {
+		case '"':
+			if (!(ptr = skip_string(ptr + 1, end, NULL))) {
+				return NULL;
+			}
+			break;
+		case '{':
+		case '[':
+			depth++;
+			ptr++;
+			break;
+		case '}':
+		case ']':
+			if (depth == 0) {
+				return NULL;
+			}
+			depth--;
+			ptr++;
+			break;
+		default:
+			if (depth == 0) {
+				// a number or literal
+				while (ptr != end && !IS_SPACE(*ptr)
+				       && *ptr != ',' && *ptr != '}'
+				       && *ptr != ']') {
+					ptr++;
+				}
+			} else {
+				ptr++;
+			}
+			break;
+		}
+	} while (depth > 0);
+
+	return ptr;
+}
+
+
+static int name_equals(const uint8_t *ptr, size_t size, int esc,
+		       const char *field, size_t field_size)
+{
+	struct utf8lite_text name;
+	struct utf8lite_text_iter it;
+	uint8_t buf[4], *dst;
+	size_t off = 0, len;
+
+	if (!esc) {
+		return size == field_size && memcmp(ptr, field, size) == 0;
+	}
+
+	if (utf8lite_text_assign(&name, ptr, size, UTF8LITE_TEXT_UNESCAPE,
+				 NULL)) {
+		return 0;
+	}
+
+	utf8lite_text_iter_make(&it, &name);
+	while (utf8lite_text_iter_advance(&it)) {
+		dst = buf;
+		utf8lite_encode_utf8(it.current, &dst);
+		len = (size_t)(dst - buf);
+		if (off + len > field_size
+				|| memcmp(field + off, buf, len) != 0) {
+			return 0;
+		}
+		off += len;
+	}
+	return off == field_size;
+}
+
+
+/*
+ * Find the field in a line holding a JSON object. A missing field and a
+ * null value give a missing text (NULL 'ptr'). We stop scanning once we
+ * find the field, so we do not validate the rest of the line.
+ */
+static int extract_field(const struct ndjson_pipeline *p,
+			 const uint8_t *ptr, const uint8_t *end,
+			 struct utf8lite_text *text, const char **msgptr)
+{
+	const uint8_t *name, *name_end, *value;
+	int esc;
+
+	text->ptr = NULL;
+	text->attr = 0;
+
+	ptr = skip_spaces(ptr, end);
+	if (ptr != end && *ptr == 'n') { // null row
+		return 0;
+	}
+	if (ptr == end || *ptr != '{') {
+		*msgptr = "row is not a JSON object";
+		return CORPUS_ERROR_INVAL;
+	}
+	ptr = skip_spaces(ptr + 1, end);
+	if (ptr != end && *ptr == '}') {
+		return 0;
+	}
+
+	for (;;) {
+		if (ptr == end || *ptr != '"') {
+			goto invalid;
+		}
+		name = ptr + 1;
+		if (!(ptr = skip_string(name, end, &esc))) {
+			goto invalid;
+		}
+		name_end = ptr - 1;
+
+		ptr = skip_spaces(ptr, end);
+		if (ptr == end || *ptr != ':') {
+			goto invalid;
+		}
+		ptr = skip_spaces(ptr + 1, end);
+
+		if (name_equals(name, (size_t)(name_end - name), esc,
+				p->field, p->field_size)) {
+			if (ptr != end && *ptr == 'n') {
+				return 0;
+			}
+			if (ptr == end || *ptr != '"') {
+				*msgptr = "field value is not a string";
+				return CORPUS_ERROR_INVAL;
+			}
+			value = ptr + 1;
+			if (!(ptr = skip_string(value, end, NULL))) {
+				goto invalid;
+			}
+			if (utf8lite_text_assign(text, value,
+						 (size_t)(ptr - 1 - value),
+						 UTF8LITE_TEXT_UNESCAPE,
+						 NULL)) {
+				*msgptr = "invalid string value";
+				return CORPUS_ERROR_INVAL;
+			}
+			return 0;
+		}
+
+		if (!(ptr = skip_value(ptr, end))) {
+			goto invalid;
+		}
+		ptr = skip_spaces(ptr, end);
+		if (ptr != end && *ptr == ',') {
+			ptr = skip_spaces(ptr + 1, end);
+			continue;
+		}
+		if (ptr != end && *ptr == '}') {
+			return 0;
+		}
+		goto invalid;
+	}
+
+invalid:
+	*msgptr = "invalid JSON object";
+	return CORPUS_ERROR_INVAL;
+}
+
+
+static void block_extract(const struct ndjson_pipeline *p, struct block *b)
+{
+	struct utf8lite_text text;
+	const uint8_t *ptr = b->data, *end = b->data + b->size, *line_end;
+	const char *msg = NULL;
+	int err;
+
+	while (ptr != end) {
+		line_end = memchr(ptr, '\n', (size_t)(end - ptr));
+		line_end = line_end ? line_end + 1 : end;
+
+		if ((err = extract_field(p, ptr, line_end, &text, &msg))
+		    || (err = block_add_text(b, &text))) {
+			b->err = err;
+			snprintf(b->message, sizeof(b->message),
+				 "failed parsing row %"PRIu64" of JSON data: %s",
+				 (uint64_t)(b->batch.first_row
+					    + b->batch.ntext + 1),
+				 msg ? msg : "failed allocating memory");
+			return;
+		}
+		ptr = line_end;
+	}
+}
+
+
+/* threads */
+
+static void pipeline_fail(struct ndjson_pipeline *p, int err,
+			  const char *message)
+{
+	pthread_mutex_lock(&p->lock);
+	if (!p->err) {
+		p->err = err;
+		snprintf(p->message, sizeof(p->message), "%s", message);
+	}
+	pthread_mutex_unlock(&p->lock);
+}
+
+
+static void *reader_work(void *arg)
+{
+	struct ndjson_pipeline *p = arg;
+	struct block *b = NULL;
+	uint8_t *carry = NULL, *data, *last;
+	size_t ncarry = 0, size, size_max, want, nread;
+	R_xlen_t nrow = 0;
+	int eof = 0;
+
+	while (!eof) {
+		TRACE_BEGIN("pipeline:read");
+
+		if (!(b = corpus_calloc(1, sizeof(*b)))) {
+			goto nomem;
+		}
+
+		// start with the partial line from the last block
+		size_max = ncarry + PIPELINE_BLOCK_SIZE;
+		if (!(b->data = corpus_malloc(size_max))) {
+			goto nomem;
+		}
+		if (ncarry) {
+			memcpy(b->data, carry, ncarry);
+		}
+		size = ncarry;
+
+		// read until there is a complete line, or the end of file
+		for (;;) {
+			want = size_max - size;
+			nread = fread(b->data + size, 1, want, p->file);
+			size += nread;
+			if (nread < want) {
+				if (ferror(p->file)) {
+					TRACE_END("pipeline:read");
+					pipeline_fail(p, CORPUS_ERROR_OS,
+						      "failed reading file");
+					goto out;
+				}
+				eof = 1;
+				break;
+			}
+			if (memchr(b->data + ncarry, '\n', size - ncarry)) {
+				break;
+			}
+			if (!(data = corpus_realloc(b->data, 2 * size_max))) {
+				goto nomem;
+			}
+			b->data = data;
+			size_max *= 2;
+		}
+
+		// split at the last newline, saving the rest for later
+		if (eof) {
+			ncarry = 0;
+			b->size = size;
+		} else {
+			last = b->data + size;
+			while (last[-1] != '\n') {
+				last--;
+			}
+			b->size = (size_t)(last - b->data);
+			ncarry = size - b->size;
+			corpus_free(carry);
+			if (!(carry = corpus_malloc(ncarry ? ncarry : 1))) {
+				goto nomem;
+			}
+			memcpy(carry, last, ncarry);
+		}
+
+		// count the rows so each block knows its first row number
+		b->batch.first_row = nrow;
+		data = b->data;
+		while ((data = memchr(data, '\n', b->size
+				      - (size_t)(data - b->data)))) {
+			data++;
+			nrow++;
+		}
+		if (b->size && b->data[b->size - 1] != '\n') {
+			nrow++;
+		}
+
+		TRACE_END("pipeline:read");
+
+		if (b->size == 0) {
+			block_free(b);
+			b = NULL;
+			continue;
+		}
+
+		// the ordered queue owns the block; push there first
+		if (queue_push(p->ordered, b)) {
+			goto out;
+		}
+		if (queue_push(p->work, b)) {
+			b = NULL;
+			goto out;
+		}
+		b = NULL;
+	}
+	goto out;
+
+nomem:
+	TRACE_END("pipeline:read");
+	pipeline_fail(p, CORPUS_ERROR_NOMEM, "failed allocating memory");
+out:
+	block_free(b);
+	corpus_free(carry);
+	queue_close(p->work);
+	queue_close(p->ordered);
+	return NULL;
+}
+
+
+static void *extractor_work(void *arg)
+{
+	struct ndjson_pipeline *p = arg;
+	void *item;
+	struct block *b;
+	int stop;
+
+	while (queue_pop(p->work, &item)) {
+		pthread_mutex_lock(&p->lock);
+		stop = p->abort;
+		pthread_mutex_unlock(&p->lock);
+		if (stop) {
+			break;
+		}
+		b = item;
+
+		TRACE_BEGIN("pipeline:extract");
+		block_extract(p, b);
+		TRACE_END("pipeline:extract");
+
+		pthread_mutex_lock(&p->lock);
+		b->done = 1;
+		pthread_cond_broadcast(&p->done);
+		pthread_mutex_unlock(&p->lock);
+	}
+
+	return NULL;
+}
+
+
+int ndjson_pipeline_open(struct ndjson_pipeline **pptr, const char *path,
+			 const char *field, int nthread, int depth)
+{
+	struct ndjson_pipeline *p;
+	int t, err = 0;
+
+	if (!(p = corpus_calloc(1, sizeof(*p)))) {
+		return CORPUS_ERROR_NOMEM;
+	}
+	pthread_mutex_init(&p->lock, NULL);
+	pthread_cond_init(&p->done, NULL);
+	*pptr = p;
+
+	p->field_size = strlen(field);
+	TRY_ALLOC(p->field = corpus_malloc(p->field_size + 1));
+	memcpy(p->field, field, p->field_size + 1);
+
+	if (!(p->file = fopen(path, "rb"))) {
+		snprintf(p->message, sizeof(p->message),
+			 "cannot open file '%s': %s", path, strerror(errno));
+		err = CORPUS_ERROR_OS;
+		goto out;
+	}
+
+	TRY(queue_open(&p->work, depth));
+	TRY(queue_open(&p->ordered, depth));
+	TRY_ALLOC(p->extractors = corpus_calloc((size_t)nthread,
+						sizeof(*p->extractors)));
+
+	if (pthread_create(&p->reader, NULL, reader_work, p)) {
+		err = CORPUS_ERROR_OS;
+		goto out;
+	}
+	p->has_reader = 1;
+
+	for (t = 0; t < nthread; t++) {
+		if (pthread_create(&p->extractors[t], NULL, extractor_work,
+				   p)) {
+			break; // proceed with fewer threads
+		}
+		p->nextractor++;
+	}
+	if (p->nextractor == 0) {
+		err = CORPUS_ERROR_OS;
+		goto out;
+	}
+
+out:
+	if (err && !p->message[0]) {
+		snprintf(p->message, sizeof(p->message), "%s",
+			 err == CORPUS_ERROR_NOMEM
+			 ? "failed allocating memory"
+			 : "failed starting threads");
+	}
+	return err;
+}
+
+
+const char *ndjson_pipeline_message(const struct ndjson_pipeline *p)
+{
+	return p->message;
+}
+
+
+int ndjson_pipeline_next(struct ndjson_pipeline *p,
+			 const struct ndjson_batch **batchptr)
+{
+	struct block *b;
+	void *item;
+	int err = 0;
+
+	block_free(p->current);
+	p->current = NULL;
+	*batchptr = NULL;
+
+	if (!queue_pop(p->ordered, &item)) {
+		// the reader is done; report any error it had
+		pthread_mutex_lock(&p->lock);
+		err = p->err;
+		pthread_mutex_unlock(&p->lock);
+		return err;
+	}
+
+	b = item;
+	p->current = b;
+
+	pthread_mutex_lock(&p->lock);
+	while (!b->done) {
+		pthread_cond_wait(&p->done, &p->lock);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	if (b->err) {
+		memcpy(p->message, b->message, sizeof(p->message));
+		return b->err;
+	}
+
+	b->batch.text = b->text;
+	*batchptr = &b->batch;
+	return 0;
+}
+
+
+void ndjson_pipeline_close(struct ndjson_pipeline *p)
+{
+	void *item;
+	int t;
+
+	if (!p) {
+		return;
+	}
+
+	pthread_mutex_lock(&p->lock);
+	p->abort = 1;
+	pthread_mutex_unlock(&p->lock);
+
+	if (p->work) {
+		queue_close(p->work);
+	}
+	if (p->ordered) {
+		queue_close(p->ordered);
+	}
+
+	if (p->has_reader) {
+		pthread_join(p->reader, NULL);
+	}
+	for (t = 0; t < p->nextractor; t++) {
+		pthread_join(p->extractors[t], NULL);
+	}
+
+	// the ordered queue holds every block still in flight
+	block_free(p->current);
+	if (p->ordered) {
+		while (queue_pop(p->ordered, &item)) {
+			block_free(item);
+		}
+	}
+
+	queue_free(p->work);
+	queue_free(p->ordered);
+	corpus_free(p->extractors);
+	if (p->file) {
+		fclose(p->file);
+	}
+	corpus_free(p->field);
+	pthread_cond_destroy(&p->done);
+	pthread_mutex_destroy(&p->lock);
+	corpus_free(p);
+}
@@ -0,0 +1,219 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rcorpus.h"
+
+/*
+ * A byte-level screen for term searches. For each search term, we take
+ * the longest run of bytes in its types that must appear, up to ASCII case,
+ * in any text containing the term; a text without any of these literals
+ * cannot match, so the search can skip it without tokenizing.
+ *
+ * The screen has to be conservative. Normalization can map non-ASCII
+ * characters to ASCII (compatibility forms, case folding, curly quotes),
+ * so texts with non-ASCII bytes, or with JSON escapes, always pass. In a
+ * plain ASCII text, a token's type is the token itself, up to case, with
+ * any whitespace inside a combined phrase replaced by the connector; so we
+ * split the types at the connector. A stemmer breaks this (a stem need not
+ * be a substring of the word), as do non-ASCII types; in those cases the
+ * screen gets disabled, and every text passes.
+ *
+ * To find the literals, we look up each pair of adjacent bytes in a bitmap
+ * of the literals' first two bytes, and only compare the literals on a hit.
+ */
+
+struct prefilter_lit {
+	const uint8_t *ptr;
+	size_t size;
+	int key;
+};
+
+#define LOWER(ch) (('A' <= (ch) && (ch) <= 'Z') ? (ch) + ('a' - 'A') : (ch))
+#define PAIR_KEY(a, b) (((int)(a) << 8) | (int)(b))
+
+
+static int lit_cmp(const void *x1, const void *x2)
+{
+	const struct prefilter_lit *l1 = x1, *l2 = x2;
+
+	if (l1->key != l2->key) {
+		return (l1->key < l2->key) ? -1 : 1;
+	}
+	return 0;
+}
+
+
+// find the longest segment of the term's types, split at the connector;
+// return 0 if the term has no usable literal
+static int term_literal(const struct corpus_filter *filter,
+			const struct corpus_termset_term *term,
+			struct prefilter_lit *lit)
+{
+	const struct utf8lite_text *type;
+	const uint8_t *ptr, *end, *seg;
+	int i, ok = 0;
+
+	lit->ptr = NULL;
+	lit->size = 0;
+
+	for (i = 0; i < term->length; i++) {
+		type = &filter->symtab.types[term->type_ids[i]].text;
+		if (UTF8LITE_TEXT_HAS_ESC(type)) {
+			return 0;
+		}
+
+		ptr = type->ptr;
+		end = ptr + UTF8LITE_TEXT_SIZE(type);
+		seg = ptr;
+
+		for (; ptr <= end; ptr++) {
+			if (ptr != end && *ptr >= 0x80) {
+				return 0;
+			}
+			if (ptr == end || (int32_t)*ptr == filter->connector) {
+				if ((size_t)(ptr - seg) > lit->size) {
+					lit->ptr = seg;
+					lit->size = (size_t)(ptr - seg);
+					ok = 1;
+				}
+				seg = ptr + 1;
+			}
+		}
+	}
+
+	return ok;
+}
+
+
+void prefilter_init(struct prefilter *pf, const struct corpus_search *search,
+		    const struct corpus_filter *filter, int stemmed)
+{
+	const struct corpus_termset *terms = &search->terms;
+	struct prefilter_lit *lit;
+	int i, key;
+
+	memset(pf, 0, sizeof(*pf));
+
+	if (stemmed || terms->nitem == 0) {
+		return;
+	}
+
+	pf->lits = (void *)R_alloc(terms->nitem, sizeof(*pf->lits));
+	for (i = 0; i < terms->nitem; i++) {
+		lit = &pf->lits[i];
+		if (!term_literal(filter, &terms->items[i], lit)) {
+			return;
+		}
+
+		if (lit->size == 1) {
+			pf->single[LOWER(lit->ptr[0])] = 1;
+			key = -1;
+		} else {
+			key = PAIR_KEY(LOWER(lit->ptr[0]), LOWER(lit->ptr[1]));
+			pf->pairs[key >> 6] |= (uint64_t)1 << (key & 63);
+		}
+		lit->key = key;
+	}
+
+	qsort(pf->lits, (size_t)terms->nitem, sizeof(*pf->lits), lit_cmp);
+	pf->nlit = terms->nitem;
+	pf->enabled = 1;
+}
+
+
+static int lit_matches(const struct prefilter_lit *lit, const uint8_t *ptr,
+		       const uint8_t *end)
+{
+	size_t i;
+
+	if ((size_t)(end - ptr) < lit->size) {
+		return 0;
+	}
+	for (i = 0; i < lit->size; i++) {
+		if (LOWER(ptr[i]) != LOWER(lit->ptr[i])) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+static int pair_matches(const struct prefilter *pf, int key,
+			const uint8_t *ptr, const uint8_t *end)
+{
+	int lo = 0, hi = pf->nlit, mid;
+
+	// find the first literal with this key
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (pf->lits[mid].key < key) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	for (; lo < pf->nlit && pf->lits[lo].key == key; lo++) {
+		if (lit_matches(&pf->lits[lo], ptr, end)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+int prefilter_pass(const struct prefilter *pf, const struct utf8lite_text *text)
+{
+	const uint8_t *ptr, *end;
+	uint8_t ch, next;
+	int key;
+
+	if (!pf->enabled || UTF8LITE_TEXT_HAS_ESC(text)) {
+		return 1;
+	}
+
+	ptr = text->ptr;
+	end = ptr + UTF8LITE_TEXT_SIZE(text);
+
+	for (; ptr != end; ptr++) {
+		ch = *ptr;
+		if (ch >= 0x80) {
+			return 1;
+		}
+		ch = LOWER(ch);
+		if (pf->single[ch]) {
+			return 1;
+		}
+		if (ptr + 1 == end) {
+			break;
+		}
+		next = ptr[1];
+		if (next >= 0x80) {
+			return 1;
+		}
+		key = PAIR_KEY(ch, LOWER(next));
+		if ((pf->pairs[key >> 6] & ((uint64_t)1 << (key & 63)))
+		    && pair_matches(pf, key, ptr, end)) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
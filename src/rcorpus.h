@@ -21,6 +21,8 @@
 #include <stdint.h>
 
 #include <Rdefines.h>
+#include <Rversion.h>
+#include <R_ext/Rdynload.h>
 
 #include "corpus/lib/utf8lite/src/utf8lite.h"
 #include "corpus/src/array.h"
@@ -44,6 +46,24 @@
 #include "corpus/src/ngram.h"
 
 
+/* ALTREP vectors appeared in R 3.5.0; ALTREP lists in R 4.3.0 */
+#if defined(R_VERSION) && R_VERSION >= R_Version(3, 5, 0)
+#  define RCORPUS_HAS_ALTREP 1
+#else
+#  define RCORPUS_HAS_ALTREP 0
+#endif
+
+#if defined(R_VERSION) && R_VERSION >= R_Version(4, 3, 0)
+#  define RCORPUS_HAS_ALTLIST 1
+#else
+#  define RCORPUS_HAS_ALTLIST 0
+#endif
+
+#if !RCORPUS_HAS_ALTREP
+#  define INTEGER_ELT(x, i) (INTEGER(x)[i])
+#  define REAL_ELT(x, i) (REAL(x)[i])
+#endif
+
 #define RCORPUS_CHECK_EVERY 1000
 #define RCORPUS_CHECK_INTERRUPT(i) \
 	do { \
@@ -52,6 +72,20 @@
 		} \
 	} while (0)
 
+#define TRACE_BEGIN(name) \
+	do { \
+		if (rcorpus_trace_enabled) { \
+			rcorpus_trace_event(name, 'B'); \
+		} \
+	} while (0)
+
+#define TRACE_END(name) \
+	do { \
+		if (rcorpus_trace_enabled) { \
+			rcorpus_trace_event(name, 'E'); \
+		} \
+	} while (0)
+
 #define TRY(x) \
 	do { \
 		if ((err = (x))) { \
@@ -66,8 +100,18 @@
 		} \
 	} while (0)
 
+#define TRACE_UNWIND() \
+	do { \
+		if (rcorpus_trace_enabled) { \
+			rcorpus_trace_event(NULL, 'U'); \
+		} \
+	} while (0)
+
 #define CHECK_ERROR_FORMAT_SEP(err, sep, fmt, ...) \
 	do { \
+		if (err) { \
+			TRACE_UNWIND(); \
+		} \
 		switch (err) { \
 		case 0: \
 			break; \
@@ -127,6 +171,16 @@ struct decode {
 	int underflow;
 };
 
+struct prefilter_lit;
+
+struct prefilter {
+	struct prefilter_lit *lits;
+	int nlit;
+	int enabled;
+	uint8_t single[256];
+	uint64_t pairs[1024];
+};
+
 struct json {
 	struct corpus_schema schema;
 	struct corpus_data *rows;
@@ -135,6 +189,25 @@ struct json {
 	int kind;
 };
 
+#define JSON_LAYOUT_MAX 8
+
+struct json_layout {
+	uint8_t *sig;
+	size_t size;
+	int type_id;
+	int trim;
+};
+
+struct json_layouts {
+	struct json_layout layout[JSON_LAYOUT_MAX];
+	int nlayout;
+	uint8_t *sig;
+	size_t sig_size;
+	size_t sig_max;
+	const uint8_t *begin;
+	const uint8_t *end;
+};
+
 enum stemmer_type {
 	STEMMER_NONE = 0,
 	STEMMER_RFUNC,
@@ -146,14 +219,33 @@ struct stemmer_rfunc {
 	SEXP rho;
 };
 
+struct stem_memo_item {
+	uint64_t hash;
+	size_t offset;
+	size_t stem_offset;
+	int size;
+	int stem_size; // -1 for NA
+};
+
+struct stem_memo {
+	uint8_t *bytes;
+	struct stem_memo_item *items;
+	int *buckets;
+	int nitem;
+	int nbucket;
+};
+
 struct stemmer {
 	union {
 		struct stemmer_rfunc rfunc;
 		struct corpus_stem_snowball snowball;
 	} value;
+	struct stem_memo *memo;
 	int type;
 	corpus_stem_func stem_func;
 	void *stem_context;
+	corpus_stem_func memo_func;
+	void *memo_context;
 	int error;
 };
 
@@ -168,6 +260,49 @@ struct rcorpus_text {
 	int has_sentfilter;
 	int valid_sentfilter;
 	int has_stemmer;
+	int sealed;
+};
+
+struct spill_entry {
+	double count;
+	double support;
+	int group;
+	int length; // followed by 'length' type ids
+};
+
+struct spill {
+	char *dir;
+	char **runs;
+	uint8_t *buf;
+	size_t nbuf;
+	size_t nbuf_max;
+	size_t stride;
+	int nrun;
+	int nrun_max;
+	int ngram_max;
+	int serial;
+};
+
+struct ndjson_batch {
+	const struct utf8lite_text *text;
+	R_xlen_t ntext;
+	R_xlen_t first_row;
+};
+
+struct ndjson_pipeline;
+struct queue;
+
+struct spill_reader;
+
+struct spill_merge {
+	struct spill_reader *readers;
+	int *heap;
+	struct spill_entry *current;
+	const int *type_ids;
+	int nreader;
+	int nheap;
+	int ngram_max;
+	int error;
 };
 
 struct termset {
@@ -205,6 +340,9 @@ void stemmer_init_none(struct stemmer *s);
 void stemmer_init_snowball(struct stemmer *s, const char *algorithm);
 void stemmer_init_rfunc(struct stemmer *s, SEXP fn, SEXP rho);
 void stemmer_destroy(struct stemmer *s);
+void stemmer_set_memo(struct stemmer *s, struct stem_memo *memo);
+int stem_memo_init(struct stem_memo *memo, SEXP types, SEXP stems);
+void stem_memo_destroy(struct stem_memo *memo);
 const char *stemmer_snowball_name(const char *alias);
 
 SEXP stem_snowball(SEXP x, SEXP algorithm);
@@ -214,10 +352,17 @@ SEXP stem_snowball(SEXP x, SEXP algorithm);
 SEXP logging_off(void);
 SEXP logging_on(void);
 
+/* tracing */
+extern int rcorpus_trace_enabled;
+void rcorpus_trace_event(const char *name, char phase);
+SEXP trace_start(void);
+SEXP trace_stop(SEXP file);
+
 /* json */
 SEXP alloc_json(SEXP buffer, SEXP field, SEXP rows, SEXP text);
 int is_json(SEXP data);
 struct json *as_json(SEXP data);
+struct json *load_json(SEXP data, int sample);
 
 SEXP as_integer_json(SEXP data);
 SEXP as_double_json(SEXP data);
@@ -243,13 +388,18 @@ SEXP alloc_filebuf(SEXP file);
 int is_filebuf(SEXP sbuf);
 struct corpus_filebuf *as_filebuf(SEXP sbuf);
 
+/* project gutenberg */
+SEXP gutenberg_read_files(SEXP paths, SEXP threads);
+
 /* text (core) */
 SEXP alloc_text(SEXP sources, SEXP source, SEXP row, SEXP start, SEXP stop,
 		SEXP names, SEXP filter);
 int is_text(SEXP text);
 struct utf8lite_text *as_text(SEXP text, R_xlen_t *lenptr);
 struct corpus_filter *text_filter(SEXP x);
+SEXP text_filter_patch(SEXP x, SEXP y);
 struct corpus_sentfilter *text_sentfilter(SEXP x);
+int text_type_kind(SEXP x);
 SEXP as_text_character(SEXP text, SEXP filter);
 
 SEXP alloc_text_handle(void);
@@ -263,9 +413,46 @@ SEXP anyNA_text(SEXP text);
 SEXP text_c(SEXP args, SEXP names, SEXP filter);
 SEXP text_trunc(SEXP x, SEXP chars, SEXP right);
 SEXP text_valid(SEXP x);
+SEXP text_compare(SEXP e1, SEXP e2, SEXP op);
+SEXP text_duplicated(SEXP x, SEXP fromlast, SEXP normalize);
+SEXP text_lookup(SEXP x, SEXP table, SEXP normalize);
+SEXP text_pack(SEXP x);
+SEXP text_seal(SEXP x);
+SEXP text_order(SEXP x, SEXP map_case, SEXP decreasing, SEXP na_last);
+SEXP text_xtfrm(SEXP x, SEXP map_case);
+SEXP text_sealed(SEXP x);
 
 /* text filter */
 SEXP as_text_filter_connector(SEXP value);
+SEXP text_filter_types(SEXP x);
+SEXP text_filter_attach(SEXP x, SEXP types, SEXP stems);
+SEXP text_filter_read(SEXP file);
+SEXP text_filter_write(SEXP file, SEXP spec, SEXP types, SEXP stems);
+
+/* spilling term counts to disk */
+int spill_init(struct spill *s, const char *dir, int ngram_max);
+void spill_destroy(struct spill *s);
+size_t spill_size(const struct spill *s);
+int spill_add(struct spill *s, const int *type_ids, int length, int group,
+	      double count, double support);
+int spill_flush(struct spill *s);
+int spill_finish(struct spill *s);
+int spill_merge_start(struct spill_merge *m, const struct spill *s);
+int spill_merge_advance(struct spill_merge *m);
+void spill_merge_destroy(struct spill_merge *m);
+
+/* pipelined NDJSON reading */
+int ndjson_pipeline_open(struct ndjson_pipeline **pptr, const char *path,
+			 const char *field, int nthread, int depth);
+int ndjson_pipeline_next(struct ndjson_pipeline *p,
+			 const struct ndjson_batch **batchptr);
+const char *ndjson_pipeline_message(const struct ndjson_pipeline *p);
+void ndjson_pipeline_close(struct ndjson_pipeline *p);
+int queue_open(struct queue **qptr, int capacity);
+void queue_free(struct queue *q);
+int queue_push(struct queue *q, void *item);
+int queue_pop(struct queue *q, void **itemptr);
+void queue_close(struct queue *q);
 
 /* search */
 SEXP alloc_search(SEXP sterms, const char *name, struct corpus_filter *filter);
@@ -273,6 +460,12 @@ int is_search(SEXP search);
 struct corpus_search *as_search(SEXP search);
 SEXP items_search(SEXP search);
 
+/* search prefilter */
+void prefilter_init(struct prefilter *pf, const struct corpus_search *search,
+		    const struct corpus_filter *filter, int stemmed);
+int prefilter_pass(const struct prefilter *pf,
+		   const struct utf8lite_text *text);
+
 /* term set */
 SEXP alloc_termset(SEXP sterms, const char *name,
 		   struct corpus_filter *filter, int allow_dup);
@@ -283,12 +476,24 @@ SEXP items_termset(SEXP termset);
 /* text processing */
 SEXP abbreviations(SEXP kind);
 SEXP term_stats(SEXP x, SEXP ngrams, SEXP min_count, SEXP max_count,
-		SEXP min_support, SEXP max_support, SEXP output_types);
-SEXP term_matrix(SEXP x, SEXP ngrams, SEXP select, SEXP group);
+		SEXP min_support, SEXP max_support, SEXP output_types,
+		SEXP support_unit, SEXP window, SEXP vocab_limit,
+		SEXP memory_limit, SEXP spill_dir);
+SEXP term_stats_ndjson(SEXP file, SEXP field, SEXP x, SEXP ngrams,
+		       SEXP min_count, SEXP max_count, SEXP min_support,
+		       SEXP max_support, SEXP output_types, SEXP vocab_limit,
+		       SEXP threads);
+SEXP term_matrix(SEXP x, SEXP ngrams, SEXP select, SEXP group,
+		 SEXP memory_limit, SEXP spill_dir);
 SEXP text_count(SEXP x, SEXP terms);
 SEXP text_detect(SEXP x, SEXP terms);
+SEXP text_detect_ndjson(SEXP file, SEXP field, SEXP x, SEXP terms,
+			SEXP threads);
 SEXP text_locate(SEXP x, SEXP terms);
 SEXP text_match(SEXP x, SEXP terms);
+SEXP text_index(SEXP x);
+SEXP text_rank(SEXP index, SEXP queries, SEXP k, SEXP method, SEXP k1,
+	       SEXP b);
 SEXP text_nsentence(SEXP x);
 SEXP text_ntoken(SEXP x);
 SEXP text_ntype(SEXP x, SEXP collapse);
@@ -297,14 +502,29 @@ SEXP text_split_tokens(SEXP x, SEXP size);
 SEXP text_sub(SEXP x, SEXP start, SEXP end);
 SEXP text_tokens(SEXP x);
 SEXP text_types(SEXP x, SEXP collapse);
+SEXP text_untoken(SEXP x, SEXP sep, SEXP join);
 SEXP stopwords(SEXP kind);
 
+/* lazy (ALTREP) results */
+void init_split_altrep(DllInfo *dll);
+void init_tokens_altrep(DllInfo *dll);
+
 /* json values */
-SEXP mmap_ndjson(SEXP file, SEXP text);
-SEXP read_ndjson(SEXP buffer, SEXP text);
+SEXP mmap_ndjson(SEXP file, SEXP text, SEXP sample);
+SEXP read_ndjson(SEXP buffer, SEXP text, SEXP sample);
+
+/* json record layouts */
+void json_layouts_init(struct json_layouts *l);
+void json_layouts_destroy(struct json_layouts *l);
+int json_layouts_match(struct json_layouts *l, const uint8_t *ptr,
+		       size_t size, struct corpus_data *data, int *idptr);
+int json_layouts_learn(struct json_layouts *l, const uint8_t *ptr,
+		       size_t size, const struct corpus_data *data,
+		       int *idptr);
 
 /* internal utility functions */
 double *as_weights(SEXP sweights, R_xlen_t n);
+int default_threads(void);
 int encodes_utf8(cetype_t ce);
 int findListElement(SEXP list, const char *str);
 SEXP getListElement(SEXP list, const char *str);
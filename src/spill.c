@@ -0,0 +1,465 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "rcorpus.h"
+
+/*
+ * External sort-merge for term counts. When the in-memory tables get too
+ * big, the caller adds their entries to the spill buffer and flushes it;
+ * a flush sorts the buffer by (term, group) and writes it to a temporary
+ * file as a run. At the end, a k-way merge over the runs produces the
+ * entries in sorted order, with the counts for equal (term, group) pairs
+ * added together.
+ *
+ * On disk, each record is the fixed-size entry header followed by
+ * 'length' type ids.
+ */
+
+// maximum number of runs to merge at once
+#define SPILL_MERGE_MAX 64
+
+// size of the stdio buffer for each run
+#define SPILL_IOBUF (1 << 16)
+
+struct spill_reader {
+	FILE *file;
+	struct spill_entry *current;
+};
+
+
+static size_t entry_stride(int ngram_max)
+{
+	size_t size = sizeof(struct spill_entry)
+		+ (size_t)ngram_max * sizeof(int);
+	size_t align = sizeof(double);
+
+	return (size + align - 1) / align * align;
+}
+
+
+static int *entry_type_ids(const struct spill_entry *e)
+{
+	return (int *)(void *)((char *)(void *)e + sizeof(*e));
+}
+
+
+static int entry_cmp(const struct spill_entry *e1,
+		     const struct spill_entry *e2)
+{
+	const int *ids1 = entry_type_ids(e1), *ids2 = entry_type_ids(e2);
+	int i, n = e1->length < e2->length ? e1->length : e2->length;
+
+	for (i = 0; i < n; i++) {
+		if (ids1[i] != ids2[i]) {
+			return ids1[i] < ids2[i] ? -1 : 1;
+		}
+	}
+	if (e1->length != e2->length) {
+		return e1->length < e2->length ? -1 : 1;
+	}
+	if (e1->group != e2->group) {
+		return e1->group < e2->group ? -1 : 1;
+	}
+	return 0;
+}
+
+
+static int entry_ptr_cmp(const void *x1, const void *x2)
+{
+	const struct spill_entry * const *e1 = x1;
+	const struct spill_entry * const *e2 = x2;
+	return entry_cmp(*e1, *e2);
+}
+
+
+static int entry_write(FILE *f, const struct spill_entry *e)
+{
+	if (fwrite(e, sizeof(*e), 1, f) != 1) {
+		return CORPUS_ERROR_OS;
+	}
+	if (e->length > 0 && fwrite(entry_type_ids(e), sizeof(int),
+				    (size_t)e->length, f)
+			!= (size_t)e->length) {
+		return CORPUS_ERROR_OS;
+	}
+	return 0;
+}
+
+
+// returns 1 if there is an entry, 0 at the end of the file, or an error
+// (negated)
+static int entry_read(FILE *f, struct spill_entry *e, int ngram_max)
+{
+	size_t n = fread(e, sizeof(*e), 1, f);
+
+	if (n != 1) {
+		return ferror(f) ? -CORPUS_ERROR_OS : 0;
+	}
+	if (e->length < 0 || e->length > ngram_max) {
+		return -CORPUS_ERROR_INTERNAL;
+	}
+	if (e->length > 0 && fread(entry_type_ids(e), sizeof(int),
+				   (size_t)e->length, f)
+			!= (size_t)e->length) {
+		return -CORPUS_ERROR_OS;
+	}
+	return 1;
+}
+
+
+int spill_init(struct spill *s, const char *dir, int ngram_max)
+{
+	size_t len = strlen(dir);
+	int err = 0;
+
+	memset(s, 0, sizeof(*s));
+	s->ngram_max = ngram_max;
+	s->stride = entry_stride(ngram_max);
+
+	TRY_ALLOC(s->dir = corpus_malloc(len + 1));
+	memcpy(s->dir, dir, len + 1);
+out:
+	return err;
+}
+
+
+void spill_destroy(struct spill *s)
+{
+	int i;
+
+	for (i = 0; i < s->nrun; i++) {
+		remove(s->runs[i]);
+		corpus_free(s->runs[i]);
+	}
+	corpus_free(s->runs);
+	corpus_free(s->buf);
+	corpus_free(s->dir);
+	memset(s, 0, sizeof(*s));
+}
+
+
+size_t spill_size(const struct spill *s)
+{
+	return s->nbuf * s->stride;
+}
+
+
+int spill_add(struct spill *s, const int *type_ids, int length, int group,
+	      double count, double support)
+{
+	struct spill_entry *e;
+	uint8_t *buf;
+	size_t max;
+	int err = 0;
+
+	if (s->nbuf == s->nbuf_max) {
+		max = s->nbuf_max ? 2 * s->nbuf_max : 1024;
+		if (max > SIZE_MAX / s->stride) {
+			return CORPUS_ERROR_OVERFLOW;
+		}
+		TRY_ALLOC(buf = corpus_realloc(s->buf, max * s->stride));
+		s->buf = buf;
+		s->nbuf_max = max;
+	}
+
+	e = (struct spill_entry *)(void *)(s->buf + s->nbuf * s->stride);
+	e->count = count;
+	e->support = support;
+	e->group = group;
+	e->length = length;
+	memcpy(entry_type_ids(e), type_ids, (size_t)length * sizeof(int));
+	s->nbuf++;
+out:
+	return err;
+}
+
+
+static int spill_new_run(struct spill *s, FILE **fptr)
+{
+	char **runs, *path;
+	size_t size;
+	int max, err = 0;
+
+	*fptr = NULL;
+
+	if (s->nrun == s->nrun_max) {
+		max = s->nrun_max ? 2 * s->nrun_max : 16;
+		TRY_ALLOC(runs = corpus_realloc(s->runs,
+						(size_t)max * sizeof(*runs)));
+		s->runs = runs;
+		s->nrun_max = max;
+	}
+
+	size = strlen(s->dir) + 64;
+	TRY_ALLOC(path = corpus_malloc(size));
+	snprintf(path, size, "%s/corpus-spill-%ld-%p-%d.bin", s->dir,
+		 (long)getpid(), (void *)s, s->serial++);
+	s->runs[s->nrun++] = path;
+
+	if (!(*fptr = fopen(path, "wb"))) {
+		err = CORPUS_ERROR_OS;
+	}
+out:
+	return err;
+}
+
+
+int spill_flush(struct spill *s)
+{
+	const struct spill_entry **order = NULL;
+	FILE *f = NULL;
+	size_t i;
+	int err = 0;
+
+	if (s->nbuf == 0) {
+		return 0;
+	}
+
+	TRACE_BEGIN("spill:flush");
+
+	TRY_ALLOC(order = corpus_malloc(s->nbuf * sizeof(*order)));
+	for (i = 0; i < s->nbuf; i++) {
+		order[i] = (const void *)(s->buf + i * s->stride);
+	}
+	qsort(order, s->nbuf, sizeof(*order), entry_ptr_cmp);
+
+	TRY(spill_new_run(s, &f));
+	for (i = 0; i < s->nbuf; i++) {
+		TRY(entry_write(f, order[i]));
+	}
+	s->nbuf = 0;
+
+	// release the buffer; the caller's tables will need the memory
+	corpus_free(s->buf);
+	s->buf = NULL;
+	s->nbuf_max = 0;
+
+out:
+	if (f && fclose(f) != 0 && !err) {
+		err = CORPUS_ERROR_OS;
+	}
+	corpus_free(order);
+	TRACE_END("spill:flush");
+	return err;
+}
+
+
+/*
+ * Binary min-heap of reader indices, ordered by the readers' current
+ * entries.
+ */
+
+static int reader_less(const struct spill_merge *m, int i, int j)
+{
+	int cmp = entry_cmp(m->readers[i].current, m->readers[j].current);
+	return cmp < 0 || (cmp == 0 && i < j);
+}
+
+
+static void heap_down(struct spill_merge *m, int pos)
+{
+	int child, tmp;
+
+	for (;;) {
+		child = 2 * pos + 1;
+		if (child >= m->nheap) {
+			break;
+		}
+		if (child + 1 < m->nheap
+				&& reader_less(m, m->heap[child + 1],
+					       m->heap[child])) {
+			child++;
+		}
+		if (!reader_less(m, m->heap[child], m->heap[pos])) {
+			break;
+		}
+		tmp = m->heap[pos];
+		m->heap[pos] = m->heap[child];
+		m->heap[child] = tmp;
+		pos = child;
+	}
+}
+
+
+static int merge_start(struct spill_merge *m, const struct spill *s,
+		       int first, int count)
+{
+	struct spill_reader *r;
+	int i, status, err = 0;
+
+	memset(m, 0, sizeof(*m));
+	m->ngram_max = s->ngram_max;
+
+	TRY_ALLOC(m->readers = corpus_calloc(count ? count : 1,
+					     sizeof(*m->readers)));
+	TRY_ALLOC(m->heap = corpus_calloc(count ? count : 1,
+					  sizeof(*m->heap)));
+	TRY_ALLOC(m->current = corpus_calloc(1, s->stride));
+	m->nreader = count;
+
+	for (i = 0; i < count; i++) {
+		r = &m->readers[i];
+		TRY_ALLOC(r->current = corpus_calloc(1, s->stride));
+		if (!(r->file = fopen(s->runs[first + i], "rb"))) {
+			err = CORPUS_ERROR_OS;
+			goto out;
+		}
+		setvbuf(r->file, NULL, _IOFBF, SPILL_IOBUF);
+
+		status = entry_read(r->file, r->current, m->ngram_max);
+		if (status < 0) {
+			err = -status;
+			goto out;
+		} else if (status > 0) {
+			m->heap[m->nheap++] = i;
+		}
+	}
+
+	for (i = m->nheap / 2 - 1; i >= 0; i--) {
+		heap_down(m, i);
+	}
+out:
+	return err;
+}
+
+
+int spill_merge_start(struct spill_merge *m, const struct spill *s)
+{
+	return merge_start(m, s, 0, s->nrun);
+}
+
+
+void spill_merge_destroy(struct spill_merge *m)
+{
+	int i;
+
+	if (m->readers) {
+		for (i = 0; i < m->nreader; i++) {
+			if (m->readers[i].file) {
+				fclose(m->readers[i].file);
+			}
+			corpus_free(m->readers[i].current);
+		}
+	}
+	corpus_free(m->readers);
+	corpus_free(m->heap);
+	corpus_free(m->current);
+	memset(m, 0, sizeof(*m));
+}
+
+
+int spill_merge_advance(struct spill_merge *m)
+{
+	struct spill_reader *r;
+	int i, status, has = 0;
+
+	if (m->error) {
+		return 0;
+	}
+
+	while (m->nheap > 0) {
+		i = m->heap[0];
+		r = &m->readers[i];
+
+		if (!has) {
+			memcpy(m->current, r->current,
+			       sizeof(*r->current) + (size_t)r->current->length
+						     * sizeof(int));
+			has = 1;
+		} else if (entry_cmp(m->current, r->current) == 0) {
+			m->current->count += r->current->count;
+			m->current->support += r->current->support;
+		} else {
+			break;
+		}
+
+		status = entry_read(r->file, r->current, m->ngram_max);
+		if (status < 0) {
+			m->error = -status;
+			return 0;
+		} else if (status == 0) {
+			m->heap[0] = m->heap[--m->nheap];
+		}
+		heap_down(m, 0);
+	}
+
+	if (has) {
+		m->type_ids = entry_type_ids(m->current);
+	}
+	return has;
+}
+
+
+/*
+ * Flush the buffer and then merge runs, SPILL_MERGE_MAX at a time, until
+ * there are few enough to merge in one pass.
+ */
+int spill_finish(struct spill *s)
+{
+	struct spill_merge m;
+	FILE *f = NULL;
+	int i, count, has_merge = 0, err = 0;
+
+	TRY(spill_flush(s));
+
+	while (s->nrun > SPILL_MERGE_MAX) {
+		RCORPUS_CHECK_INTERRUPT(s->nrun);
+		TRACE_BEGIN("spill:merge");
+
+		count = SPILL_MERGE_MAX;
+		TRY(merge_start(&m, s, 0, count));
+		has_merge = 1;
+		TRY(spill_new_run(s, &f));
+		while (spill_merge_advance(&m)) {
+			TRY(entry_write(f, m.current));
+		}
+		TRY(m.error);
+		spill_merge_destroy(&m);
+		has_merge = 0;
+
+		if (fclose(f) != 0) {
+			f = NULL;
+			err = CORPUS_ERROR_OS;
+			goto out;
+		}
+		f = NULL;
+
+		// drop the merged runs
+		for (i = 0; i < count; i++) {
+			remove(s->runs[i]);
+			corpus_free(s->runs[i]);
+		}
+		memmove(s->runs, s->runs + count,
+			(size_t)(s->nrun - count) * sizeof(*s->runs));
+		s->nrun -= count;
+
+		TRACE_END("spill:merge");
+	}
+
+out:
+	if (has_merge) {
+		spill_merge_destroy(&m);
+	}
+	if (f) {
+		fclose(f);
+	}
+	return err;
+}
@@ -15,6 +15,7 @@
  */
 
 #include <assert.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <string.h>
@@ -68,6 +69,7 @@ const char *stemmer_snowball_name(const char *alias)
 void stemmer_init_none(struct stemmer *s)
 {
 	s->type = STEMMER_NONE;
+	s->memo = NULL;
 	s->stem_func = NULL;
 	s->stem_context = NULL;
 	s->error = 0;
@@ -79,6 +81,8 @@ void stemmer_init_snowball(struct stemmer *s, const char *algorithm)
 	const char *name = stemmer_snowball_name(algorithm);
 	int err;
 
+	s->memo = NULL;
+
 	if (!name) {
 		s->error = CORPUS_ERROR_INVAL;
 		error("unrecognized stemmer: '%s'", algorithm);
@@ -204,6 +208,7 @@ void stemmer_init_rfunc(struct stemmer *s, SEXP fn, SEXP rho)
 {
 	s->value.rfunc.fn = fn;
 	s->value.rfunc.rho = rho;
+	s->memo = NULL;
 	s->type = STEMMER_RFUNC;
 	s->stem_func = stem_rfunc;
 	s->stem_context = s;
@@ -213,6 +218,12 @@ void stemmer_init_rfunc(struct stemmer *s, SEXP fn, SEXP rho)
 
 void stemmer_destroy(struct stemmer *s)
 {
+	if (s->memo) {
+		stem_memo_destroy(s->memo);
+		corpus_free(s->memo);
+		s->memo = NULL;
+	}
+
 	switch (s->type) {
 	case STEMMER_SNOWBALL:
 		corpus_stem_snowball_destroy(&s->value.snowball);
@@ -223,6 +234,187 @@ void stemmer_destroy(struct stemmer *s)
 }
 
 
+/*
+ * A stem memo holds the stems for a fixed set of types, loaded from a
+ * saved filter, so that rebuilding the filter does not need to call the
+ * stemmer (possibly an R function) for those types again.
+ */
+
+static uint64_t stem_memo_hash(const uint8_t *ptr, size_t size)
+{
+	uint64_t hash = UINT64_C(14695981039346656037);
+	size_t i;
+
+	for (i = 0; i < size; i++) {
+		hash ^= ptr[i];
+		hash *= UINT64_C(1099511628211);
+	}
+	return hash;
+}
+
+
+int stem_memo_init(struct stem_memo *memo, SEXP stypes, SEXP sstems)
+{
+	SEXP type, stem;
+	struct stem_memo_item *item;
+	size_t size, off;
+	R_xlen_t i, n;
+	int b, mask, err = 0;
+
+	memset(memo, 0, sizeof(*memo));
+
+	n = XLENGTH(stypes);
+	if (XLENGTH(sstems) != n) {
+		err = CORPUS_ERROR_INVAL;
+		goto out;
+	}
+	// keep 2 * n, and so the bucket count, at most 2^30
+	if (n > INT_MAX / 4) {
+		err = CORPUS_ERROR_OVERFLOW;
+		goto out;
+	}
+
+	size = 0;
+	for (i = 0; i < n; i++) {
+		size += (size_t)LENGTH(STRING_ELT(stypes, i));
+		stem = STRING_ELT(sstems, i);
+		if (stem != NA_STRING) {
+			size += (size_t)LENGTH(stem);
+		}
+	}
+
+	memo->nbucket = 1;
+	while (memo->nbucket < 2 * n) {
+		memo->nbucket *= 2;
+	}
+	mask = memo->nbucket - 1;
+
+	TRY_ALLOC(memo->bytes = corpus_malloc(size ? size : 1));
+	TRY_ALLOC(memo->items = corpus_malloc((n ? n : 1) * sizeof(*item)));
+	TRY_ALLOC(memo->buckets = corpus_malloc((size_t)memo->nbucket
+						* sizeof(*memo->buckets)));
+	for (b = 0; b < memo->nbucket; b++) {
+		memo->buckets[b] = -1;
+	}
+
+	off = 0;
+	for (i = 0; i < n; i++) {
+		type = STRING_ELT(stypes, i);
+		stem = STRING_ELT(sstems, i);
+		item = &memo->items[i];
+
+		item->offset = off;
+		item->size = LENGTH(type);
+		memcpy(memo->bytes + off, CHAR(type), item->size);
+		off += item->size;
+
+		item->stem_offset = off;
+		if (stem == NA_STRING) {
+			item->stem_size = -1;
+		} else {
+			item->stem_size = LENGTH(stem);
+			memcpy(memo->bytes + off, CHAR(stem), item->stem_size);
+			off += item->stem_size;
+		}
+
+		item->hash = stem_memo_hash(memo->bytes + item->offset,
+					    item->size);
+
+		// linear probing; later duplicates get ignored
+		b = (int)(item->hash & mask);
+		while (memo->buckets[b] >= 0) {
+			b = (b + 1) & mask;
+		}
+		memo->buckets[b] = (int)i;
+		memo->nitem++;
+	}
+
+out:
+	if (err) {
+		stem_memo_destroy(memo);
+	}
+	return err;
+}
+
+
+void stem_memo_destroy(struct stem_memo *memo)
+{
+	corpus_free(memo->buckets);
+	corpus_free(memo->items);
+	corpus_free(memo->bytes);
+	memset(memo, 0, sizeof(*memo));
+}
+
+
+static const struct stem_memo_item *stem_memo_find(
+	const struct stem_memo *memo, const uint8_t *ptr, int len)
+{
+	const struct stem_memo_item *item;
+	uint64_t hash;
+	int b, id, mask;
+
+	if (memo->nitem == 0) {
+		return NULL;
+	}
+
+	hash = stem_memo_hash(ptr, (size_t)len);
+	mask = memo->nbucket - 1;
+	b = (int)(hash & mask);
+
+	while ((id = memo->buckets[b]) >= 0) {
+		item = &memo->items[id];
+		if (item->hash == hash && item->size == len
+		    && memcmp(memo->bytes + item->offset, ptr, len) == 0) {
+			return item;
+		}
+		b = (b + 1) & mask;
+	}
+
+	return NULL;
+}
+
+
+static int stem_memo_func(const uint8_t *ptr, int len,
+			  const uint8_t **stemptr, int *lenptr, void *context)
+{
+	struct stemmer *s = context;
+	const struct stem_memo_item *item;
+
+	if ((item = stem_memo_find(s->memo, ptr, len))) {
+		if (stemptr) {
+			*stemptr = (item->stem_size < 0 ? NULL
+				    : s->memo->bytes + item->stem_offset);
+		}
+		if (lenptr) {
+			*lenptr = item->stem_size;
+		}
+		return 0;
+	}
+
+	return s->memo_func(ptr, len, stemptr, lenptr, s->memo_context);
+}
+
+
+/*
+ * Put a memo in front of the stemmer; the stemmer takes ownership of
+ * the memo. Only stemmers that have a stem function get one.
+ */
+void stemmer_set_memo(struct stemmer *s, struct stem_memo *memo)
+{
+	if (!s->stem_func) {
+		stem_memo_destroy(memo);
+		corpus_free(memo);
+		return;
+	}
+
+	s->memo = memo;
+	s->memo_func = s->stem_func;
+	s->memo_context = s->stem_context;
+	s->stem_func = stem_memo_func;
+	s->stem_context = s;
+}
+
+
 struct stem_snowball_context {
 	struct corpus_stem_snowball snowball;
 	int has_snowball;
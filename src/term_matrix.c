@@ -16,6 +16,7 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
@@ -27,9 +28,16 @@ struct context {
 	struct utf8lite_render render;
 	struct corpus_termset termset;
 	struct corpus_ngram *ngram;
+	struct spill spill;
+	struct spill_merge merge;
+	double memory_limit;
+	double nnode;
 	int *buffer;
 	int *ngram_set;
-	int has_render, has_termset;
+	int *prev;
+	int prev_length;
+	int ngram_max;
+	int has_render, has_termset, has_spill, has_merge, spilled;
 	R_xlen_t has_ngram;
 };
 
@@ -61,7 +69,10 @@ static void context_init(struct context *ctx, SEXP sngrams,
 		ngram_max = select ? select->max_length : 1;
 	}
 
+	ctx->ngram_max = ngram_max;
 	ctx->buffer = (void *)R_alloc(ngram_max, sizeof(*ctx->buffer));
+	ctx->prev = (void *)R_alloc(ngram_max, sizeof(*ctx->prev));
+	ctx->prev_length = -1;
 	ctx->ngram_set = (void *)R_alloc(ngram_max + 1,
 					 sizeof(*ctx->ngram_set));
 	memset(ctx->ngram_set, 0, (ngram_max + 1) * sizeof(*ctx->ngram_set));
@@ -99,6 +110,14 @@ static void context_destroy(void *obj)
 {
 	struct context *ctx = obj;
 
+	if (ctx->has_merge) {
+		spill_merge_destroy(&ctx->merge);
+	}
+
+	if (ctx->has_spill) {
+		spill_destroy(&ctx->spill);
+	}
+
 	if (ctx->has_render) {
 		utf8lite_render_destroy(&ctx->render);
 	}
@@ -115,20 +134,185 @@ static void context_destroy(void *obj)
 }
 
 
-SEXP term_matrix(SEXP sx, SEXP sngrams, SEXP sselect, SEXP sgroup)
+static void context_set_spill(struct context *ctx, SEXP smemory_limit,
+			      SEXP sspill_dir, R_xlen_t ngroup)
+{
+	const char *dir;
+	int err = 0;
+
+	if (smemory_limit == R_NilValue) {
+		return;
+	}
+
+	if (ngroup > INT_MAX) {
+		error("number of groups exceeds maximum (%d)"
+		      " for 'memory_limit'", INT_MAX);
+	}
+
+	ctx->memory_limit = REAL(smemory_limit)[0];
+	dir = translateChar(STRING_ELT(sspill_dir, 0));
+	TRY(spill_init(&ctx->spill, dir, ctx->ngram_max));
+	ctx->has_spill = 1;
+out:
+	CHECK_ERROR(err);
+}
+
+
+// estimated size of the n-gram tables, in bytes
+static double context_size(const struct context *ctx)
+{
+	double node = (double)(sizeof(struct corpus_tree_node) + sizeof(int)
+			       + sizeof(double));
+	return node * ctx->nnode;
+}
+
+
+/*
+ * Move the wanted n-gram counts for every group to a sorted run on disk,
+ * and start over with empty tables.
+ */
+static void context_spill(struct context *ctx, const struct termset *select,
+			  R_xlen_t ngroup)
+{
+	struct corpus_ngram_iter it;
+	struct corpus_ngram empty;
+	R_xlen_t g;
+	int err = 0;
+
+	for (g = 0; g < ngroup; g++) {
+		RCORPUS_CHECK_INTERRUPT(g);
+
+		if (ctx->ngram[g].terms.nnode == 0) {
+			continue;
+		}
+
+		corpus_ngram_iter_make(&it, &ctx->ngram[g], ctx->buffer);
+		while (corpus_ngram_iter_advance(&it)) {
+			if (!ctx->ngram_set[it.length]) {
+				continue;
+			}
+			if (select && !corpus_termset_has(&select->set,
+							  it.type_ids,
+							  it.length, NULL)) {
+				continue;
+			}
+			TRY(spill_add(&ctx->spill, it.type_ids, it.length,
+				      (int)g, it.weight, 0));
+		}
+
+		// replace the table to release its memory
+		TRY(corpus_ngram_init(&empty, ctx->ngram_max));
+		corpus_ngram_destroy(&ctx->ngram[g]);
+		ctx->ngram[g] = empty;
+	}
+	ctx->nnode = 0;
+
+	TRY(spill_flush(&ctx->spill));
+	ctx->spilled = 1;
+out:
+	CHECK_ERROR_MESSAGE(err, "failed spilling term counts to disk");
+}
+
+
+static void context_merge_start(struct context *ctx)
+{
+	int err = 0;
+
+	if (ctx->has_merge) {
+		spill_merge_destroy(&ctx->merge);
+		ctx->has_merge = 0;
+	}
+	TRY(spill_merge_start(&ctx->merge, &ctx->spill));
+	ctx->has_merge = 1;
+out:
+	CHECK_ERROR_MESSAGE(err, "failed reading spilled term counts");
+}
+
+
+// advance the merge, reporting whether the term differs from the last one
+static int context_merge_advance(struct context *ctx, int *is_new)
+{
+	const struct spill_entry *e;
+	int err = 0, length;
+
+	if (!spill_merge_advance(&ctx->merge)) {
+		TRY(ctx->merge.error);
+		return 0;
+	}
+
+	e = ctx->merge.current;
+	length = e->length;
+	*is_new = (length != ctx->prev_length
+		   || memcmp(ctx->prev, ctx->merge.type_ids,
+			     (size_t)length * sizeof(int)) != 0);
+	if (*is_new) {
+		memcpy(ctx->prev, ctx->merge.type_ids,
+		       (size_t)length * sizeof(int));
+		ctx->prev_length = length;
+	}
+	return 1;
+out:
+	CHECK_ERROR_MESSAGE(err, "failed reading spilled term counts");
+	return 0;
+}
+
+
+static SEXP render_term(struct context *ctx, const struct corpus_filter *filter,
+			const int *type_ids, int length)
+{
+	const struct utf8lite_text *type;
+	SEXP sterm = NA_STRING;
+	int j, err = 0;
+
+	for (j = 0; j < length; j++) {
+		type = &filter->symtab.types[type_ids[j]].text;
+		if (j > 0) {
+			utf8lite_render_char(&ctx->render, ' ');
+		}
+		utf8lite_render_text(&ctx->render, type);
+	}
+	TRY(ctx->render.error);
+
+	sterm = mkCharLenCE(ctx->render.string, ctx->render.length, CE_UTF8);
+	utf8lite_render_clear(&ctx->render);
+out:
+	CHECK_ERROR(err);
+	return sterm;
+}
+
+
+/*
+ * The output columns hold integers when the values fit, which they
+ * always do for the counts unless a term appears more than INT_MAX times
+ * in a group, and do for the row indices unless there are more than
+ * INT_MAX groups. Otherwise, they hold doubles.
+ */
+static void set_value(SEXP x, R_xlen_t off, double value)
+{
+	if (TYPEOF(x) == INTSXP) {
+		INTEGER(x)[off] = (int)value;
+	} else {
+		REAL(x)[off] = value;
+	}
+}
+
+
+SEXP term_matrix(SEXP sx, SEXP sngrams, SEXP sselect, SEXP sgroup,
+		 SEXP smemory_limit, SEXP sspill_dir)
 {
 	SEXP ans = R_NilValue, sctx, snames, si, sj, scount, stext,
-	     scol_names, srow_names, sterm;
+	     scol_names, srow_names;
 	struct context *ctx;
-	const struct utf8lite_text *text, *type;
+	const struct utf8lite_text *text;
 	struct corpus_filter *filter;
 	const struct termset *select;
 	const struct corpus_termset *terms;
-	const int *type_ids;
+	const struct spill_entry *e;
 	const int *group;
 	struct corpus_ngram_iter it;
 	R_xlen_t i, n, g, ngroup, nz, off;
-	int err = 0, j, m, term_id, type_id, nprot = 0;
+	double count_max;
+	int err = 0, term_id, type_id, nnode, nterm, is_new, nprot = 0;
 
 	PROTECT(stext = coerce_text(sx)); nprot++;
 	text = as_text(stext, &n);
@@ -159,7 +343,9 @@ SEXP term_matrix(SEXP sx, SEXP sngrams, SEXP sselect, SEXP sgroup)
 	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy)); nprot++;
         ctx = as_context(sctx);
 	context_init(ctx, sngrams, select, ngroup);
+	context_set_spill(ctx, smemory_limit, sspill_dir, ngroup);
 
+	TRACE_BEGIN("term_matrix:scan");
 	for (i = 0; i < n; i++) {
 		RCORPUS_CHECK_INTERRUPT(i);
 
@@ -172,6 +358,8 @@ SEXP term_matrix(SEXP sx, SEXP sngrams, SEXP sselect, SEXP sgroup)
 			g = (R_xlen_t)(group[i] - 1);
 		}
 
+		nnode = ctx->ngram[g].terms.nnode;
+
 		TRY(corpus_filter_start(filter, &text[i]));
 
 		while (corpus_filter_advance(filter)) {
@@ -188,86 +376,151 @@ SEXP term_matrix(SEXP sx, SEXP sngrams, SEXP sselect, SEXP sgroup)
 		TRY(filter->error);
 
 		TRY(corpus_ngram_break(&ctx->ngram[g]));
-	}
 
-	nz = 0;
+		// spill when the tables reach half the budget, leaving room
+		// for the sort buffer
+		if (ctx->has_spill) {
+			ctx->nnode += ctx->ngram[g].terms.nnode - nnode;
+			if (context_size(ctx) > ctx->memory_limit / 2) {
+				context_spill(ctx, select, ngroup);
+			}
+		}
+	}
+	TRACE_END("term_matrix:scan");
 
-	for (g = 0; g < ngroup; g++) {
-		RCORPUS_CHECK_INTERRUPT(g);
+	// if we spilled, put the rest on disk too and merge from there
+	if (ctx->spilled) {
+		context_spill(ctx, select, ngroup);
+		TRY(spill_finish(&ctx->spill));
+	}
 
-		corpus_ngram_iter_make(&it, &ctx->ngram[g], ctx->buffer);
-		while (corpus_ngram_iter_advance(&it)) {
-			if (!ctx->ngram_set[it.length]) {
-				continue;
+	TRACE_BEGIN("term_matrix:output");
+	nz = 0;
+	nterm = 0;
+	count_max = 0;
+
+	if (ctx->spilled) {
+		ctx->prev_length = -1;
+		context_merge_start(ctx);
+		while (context_merge_advance(ctx, &is_new)) {
+			RCORPUS_CHECK_INTERRUPT(nz);
+			if (is_new) {
+				nterm++;
 			}
-
-			if (select) {
-			       if (!corpus_termset_has(&select->set,
-						       it.type_ids,
-						       it.length, NULL)) {
-				       continue;
-			       }
-			} else {
-				TRY(corpus_termset_add(&ctx->termset,
-						       it.type_ids,
-						       it.length, NULL));
+			if (ctx->merge.current->count > count_max) {
+				count_max = ctx->merge.current->count;
 			}
-
 			TRY(nz == R_XLEN_T_MAX ? CORPUS_ERROR_OVERFLOW : 0);
 			nz++;
 		}
+	} else {
+		for (g = 0; g < ngroup; g++) {
+			RCORPUS_CHECK_INTERRUPT(g);
+
+			corpus_ngram_iter_make(&it, &ctx->ngram[g], ctx->buffer);
+			while (corpus_ngram_iter_advance(&it)) {
+				if (!ctx->ngram_set[it.length]) {
+					continue;
+				}
+
+				if (select) {
+				       if (!corpus_termset_has(&select->set,
+							       it.type_ids,
+							       it.length, NULL)) {
+					       continue;
+				       }
+				} else {
+					TRY(corpus_termset_add(&ctx->termset,
+							       it.type_ids,
+							       it.length, NULL));
+				}
+
+				if (it.weight > count_max) {
+					count_max = it.weight;
+				}
+				TRY(nz == R_XLEN_T_MAX ? CORPUS_ERROR_OVERFLOW : 0);
+				nz++;
+			}
+		}
 	}
 
-	PROTECT(si = allocVector(REALSXP, nz)); nprot++;
+	PROTECT(si = allocVector(ngroup <= INT_MAX ? INTSXP : REALSXP, nz));
+	nprot++;
 	PROTECT(sj = allocVector(INTSXP, nz)); nprot++;
-	PROTECT(scount = allocVector(REALSXP, nz)); nprot++;
+	PROTECT(scount = allocVector(count_max <= INT_MAX ? INTSXP : REALSXP,
+				     nz)); nprot++;
 
 	off = 0;
 	terms = select ? &select->set : &ctx->termset;
-	for (g = 0; g < ngroup; g++) {
-		RCORPUS_CHECK_INTERRUPT(g);
 
-		corpus_ngram_iter_make(&it, &ctx->ngram[g], ctx->buffer);
-		while (corpus_ngram_iter_advance(&it)) {
-			if (!ctx->ngram_set[it.length]) {
-				continue;
-			}
+	if (ctx->spilled) {
+		// the merge is in (term, group) order; number the terms in
+		// that order unless they come from 'select'
+		if (!select) {
+			PROTECT(scol_names = allocVector(STRSXP, nterm));
+			nprot++;
+		}
 
-			if (!corpus_termset_has(terms, it.type_ids,
-						it.length, &term_id)) {
-				continue;
+		term_id = -1;
+		ctx->prev_length = -1;
+		context_merge_start(ctx);
+		while (context_merge_advance(ctx, &is_new)) {
+			RCORPUS_CHECK_INTERRUPT(off);
+
+			e = ctx->merge.current;
+			if (is_new) {
+				if (select) {
+					corpus_termset_has(terms,
+							   ctx->merge.type_ids,
+							   e->length, &term_id);
+				} else {
+					term_id++;
+					SET_STRING_ELT(scol_names, term_id,
+						render_term(ctx, filter,
+							    ctx->merge.type_ids,
+							    e->length));
+				}
 			}
 
-			REAL(si)[off] = (double)g;
+			set_value(si, off, (double)e->group);
 			INTEGER(sj)[off] = term_id;
-			REAL(scount)[off] = it.weight;
+			set_value(scount, off, e->count);
 			off++;
 		}
-	}
-
-	PROTECT(scol_names = allocVector(STRSXP, terms->nitem));
-	nprot++;
-
-	for (i = 0; i < terms->nitem; i++) {
-		RCORPUS_CHECK_INTERRUPT(i);
-
-		type_ids = terms->items[i].type_ids;
-		m = terms->items[i].length;
-
-		for (j = 0; j < m; j++) {
-			type = &filter->symtab.types[type_ids[j]].text;
-			if (j > 0) {
-				utf8lite_render_char(&ctx->render, ' ');
+	} else {
+		for (g = 0; g < ngroup; g++) {
+			RCORPUS_CHECK_INTERRUPT(g);
+
+			corpus_ngram_iter_make(&it, &ctx->ngram[g], ctx->buffer);
+			while (corpus_ngram_iter_advance(&it)) {
+				if (!ctx->ngram_set[it.length]) {
+					continue;
+				}
+
+				if (!corpus_termset_has(terms, it.type_ids,
+							it.length, &term_id)) {
+					continue;
+				}
+
+				set_value(si, off, (double)g);
+				INTEGER(sj)[off] = term_id;
+				set_value(scount, off, it.weight);
+				off++;
 			}
-			utf8lite_render_text(&ctx->render, type);
 		}
-		TRY(ctx->render.error);
+	}
 
-		sterm = mkCharLenCE(ctx->render.string, ctx->render.length,
-				    CE_UTF8);
-		utf8lite_render_clear(&ctx->render);
+	if (!ctx->spilled || select) {
+		PROTECT(scol_names = allocVector(STRSXP, terms->nitem));
+		nprot++;
 
-		SET_STRING_ELT(scol_names, i, sterm);
+		for (i = 0; i < terms->nitem; i++) {
+			RCORPUS_CHECK_INTERRUPT(i);
+			SET_STRING_ELT(scol_names, i,
+				       render_term(ctx, filter,
+						   terms->items[i].type_ids,
+						   terms->items[i].length));
+		}
 	}
 
 	PROTECT(ans = allocVector(VECSXP, 5)); nprot++;
@@ -284,6 +537,7 @@ SEXP term_matrix(SEXP sx, SEXP sngrams, SEXP sselect, SEXP sgroup)
 	SET_STRING_ELT(snames, 3, mkChar("row_names"));
 	SET_STRING_ELT(snames, 4, mkChar("col_names"));
 	setAttrib(ans, R_NamesSymbol, snames);
+	TRACE_END("term_matrix:output");
 
 out:
 	CHECK_ERROR(err);
@@ -17,8 +17,10 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <math.h>
+#include <pthread.h>
 #include <stddef.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <string.h>
 #include "rcorpus.h"
 
@@ -32,9 +34,26 @@ struct context {
 	struct utf8lite_render render;
 	struct corpus_ngram ngram;
 	struct corpus_termset termset;
+	struct spill spill;
+	struct spill_merge merge;
+	double memory_limit;
+	int vocab_limit;
 	int has_render;
 	int has_ngram;
 	int has_termset;
+	int has_spill;
+	int has_merge;
+	int spilled;
+};
+
+// iterate over the terms, in memory or merged from the spill files
+struct term_iter {
+	struct context *ctx;
+	const int *type_ids;
+	int length;
+	double count;
+	double support;
+	int index;
 };
 
 
@@ -90,6 +109,13 @@ static void context_destroy(void *obj)
 {
 	struct context *ctx = obj;
 
+	if (ctx->has_merge) {
+		spill_merge_destroy(&ctx->merge);
+	}
+	if (ctx->has_spill) {
+		spill_destroy(&ctx->spill);
+	}
+
 	corpus_free(ctx->count);
 	corpus_free(ctx->support);
 
@@ -105,7 +131,8 @@ static void context_destroy(void *obj)
 }
 
 
-static void context_update(struct context *ctx, double weight)
+// count the n-grams in the buffer, with the given support, and clear it
+static int context_count(struct context *ctx, double weight)
 {
 	struct corpus_ngram_iter it;
 	size_t size;
@@ -151,79 +178,393 @@ static void context_update(struct context *ctx, double weight)
 		ctx->support[term_id] += weight;
 	}
 	corpus_ngram_clear(&ctx->ngram);
+out:
+	return err;
+}
+
+
+static void context_update(struct context *ctx, double weight)
+{
+	int err = 0;
+
+	TRY(context_count(ctx, weight));
 out:
 	CHECK_ERROR(err);
 }
 
 
-SEXP term_stats(SEXP sx, SEXP sngrams, SEXP smin_count, SEXP smax_count,
-		SEXP smin_support, SEXP smax_support, SEXP soutput_types)
+/*
+ * Scan the tokens of a text, or of a sentence, and update the counts.
+ * Support gets incremented once per unit: the whole text when 'window' is
+ * 0, otherwise each run of 'window' consecutive tokens (and the final,
+ * shorter run). N-grams do not cross the unit boundaries.
+ */
+static void context_scan(struct context *ctx, struct corpus_filter *filter,
+			 const struct utf8lite_text *text, int window)
 {
-	SEXP ans, sctx, sterm, scount, ssupport, stext,
-	     sclass, snames, srow_names, stype = NA_STRING;
-	SEXP *stypes;
-	struct context *ctx;
-	const struct utf8lite_text *text, *type = NULL;
-	const struct corpus_termset_term *term;
-	struct mkchar mkchar;
-	struct corpus_filter *filter;
-	double count, supp, min_count, max_count, min_support, max_support;
-	R_xlen_t i, n, iterm, nterm;
-	int output_types;
-	int off, len, j, type_id, err = 0, nprot = 0;
+	int type_id, ntoken = 0, err = 0;
 
-	PROTECT(stext = coerce_text(sx)); nprot++;
-	text = as_text(stext, &n);
-	filter = text_filter(stext);
+	TRY(corpus_filter_start(filter, text));
 
-	if (sngrams != R_NilValue) {
-		PROTECT(sngrams = coerceVector(sngrams, INTSXP)); nprot++;
+	while (corpus_filter_advance(filter)) {
+		type_id = filter->type_id;
+
+		if (type_id == CORPUS_TYPE_NONE) {
+			continue;
+		} else if (type_id < 0) {
+			TRY(corpus_ngram_break(&ctx->ngram));
+			continue;
+		}
+
+		TRY(corpus_ngram_add(&ctx->ngram, type_id, 1));
+		ntoken++;
+
+		if (ntoken == window) {
+			TRY(corpus_ngram_break(&ctx->ngram));
+			context_update(ctx, 1);
+			ntoken = 0;
+		}
 	}
+	TRY(filter->error);
 
-	min_count = smin_count == R_NilValue ? -INFINITY : REAL(smin_count)[0];
-	max_count = smax_count == R_NilValue ? INFINITY : REAL(smax_count)[0];
+	TRY(corpus_ngram_break(&ctx->ngram));
+	if (window == 0 || ntoken > 0) {
+		context_update(ctx, 1);
+	}
+out:
+	CHECK_ERROR(err);
+}
 
-	min_support = (smin_support == R_NilValue ? -INFINITY
-						  : REAL(smin_support)[0]);
-	max_support = (smax_support == R_NilValue ? INFINITY
-						  : REAL(smax_support)[0]);
 
-	output_types = (LOGICAL(soutput_types)[0] == TRUE);
+static void context_set_spill(struct context *ctx, SEXP smemory_limit,
+			      SEXP sspill_dir)
+{
+	const char *dir;
+	int err = 0;
 
-	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy)); nprot++;
-        ctx = as_context(sctx);
-	context_init(ctx, sngrams);
+	if (smemory_limit == R_NilValue) {
+		return;
+	}
 
-	for (i = 0; i < n; i++) {
+	ctx->memory_limit = REAL(smemory_limit)[0];
+	dir = translateChar(STRING_ELT(sspill_dir, 0));
+	TRY(spill_init(&ctx->spill, dir, ctx->ngram_max));
+	ctx->has_spill = 1;
+out:
+	CHECK_ERROR(err);
+}
+
+
+// estimated size of the term table and the counts, in bytes
+static double context_size(const struct context *ctx)
+{
+	double node = (double)(sizeof(struct corpus_tree_node) + sizeof(int));
+	double item = (double)(sizeof(struct corpus_termset_term)
+			       + (size_t)ctx->ngram_max * sizeof(int)
+			       + 2 * sizeof(double) + sizeof(int));
+
+	return node * ctx->termset.prefixes.nnode
+		+ item * ctx->termset.nitem_max;
+}
+
+
+/*
+ * Move the terms and their counts to a sorted run on disk, and start over
+ * with an empty table.
+ */
+static void context_spill(struct context *ctx)
+{
+	const struct corpus_termset_term *term;
+	int i, err = 0;
+
+	for (i = 0; i < ctx->termset.nitem; i++) {
 		RCORPUS_CHECK_INTERRUPT(i);
 
-		TRY(corpus_filter_start(filter, &text[i]));
+		term = &ctx->termset.items[i];
+		TRY(spill_add(&ctx->spill, term->type_ids, term->length, 0,
+			      ctx->count[i], ctx->support[i]));
+	}
 
-		while (corpus_filter_advance(filter)) {
-			type_id = filter->type_id;
+	corpus_termset_destroy(&ctx->termset);
+	ctx->has_termset = 0;
+	corpus_free(ctx->count);
+	ctx->count = NULL;
+	corpus_free(ctx->support);
+	ctx->support = NULL;
 
-			if (type_id == CORPUS_TYPE_NONE) {
-				continue;
-			} else if (type_id < 0) {
-				TRY(corpus_ngram_break(&ctx->ngram));
-				continue;
+	TRY(spill_flush(&ctx->spill));
+
+	TRY(corpus_termset_init(&ctx->termset));
+	ctx->has_termset = 1;
+	ctx->spilled = 1;
+out:
+	CHECK_ERROR_MESSAGE(err, "failed spilling term counts to disk");
+}
+
+
+/*
+ * Compact the term table once it holds more than 'vocab_limit' terms:
+ * drop the terms with counts below a threshold, starting at 2 and doubling
+ * until at most half the limit survive, and renumber the rest densely, in
+ * their original order. The counts and supports move with their terms;
+ * the n-gram buffer is empty between units, so nothing else refers to the
+ * old ids. A dropped term that appears again starts over from zero.
+ */
+static int context_prune(struct context *ctx)
+{
+	struct corpus_termset termset;
+	const struct corpus_termset_term *term;
+	double *count, *support, threshold;
+	size_t size;
+	int i, nkeep, target, id, has_termset = 0, err = 0;
+
+	if (!ctx->vocab_limit || ctx->termset.nitem <= ctx->vocab_limit) {
+		return 0;
+	}
+
+	target = ctx->vocab_limit / 2;
+	threshold = 2;
+	for (;;) {
+		nkeep = 0;
+		for (i = 0; i < ctx->termset.nitem; i++) {
+			if (ctx->count[i] >= threshold) {
+				nkeep++;
 			}
+		}
+		if (nkeep <= target) {
+			break;
+		}
+		threshold *= 2;
+	}
 
-			TRY(corpus_ngram_add(&ctx->ngram, type_id, 1));
+	TRY(corpus_termset_init(&termset));
+	has_termset = 1;
+
+	// new ids never exceed old ones, so we can move the counts in place
+	for (i = 0; i < ctx->termset.nitem; i++) {
+		if (ctx->count[i] < threshold) {
+			continue;
 		}
-		TRY(filter->error);
+		term = &ctx->termset.items[i];
+		TRY(corpus_termset_add(&termset, term->type_ids, term->length,
+				       &id));
+		ctx->count[id] = ctx->count[i];
+		ctx->support[id] = ctx->support[i];
+	}
 
-		TRY(corpus_ngram_break(&ctx->ngram));
-		context_update(ctx, 1);
+	corpus_termset_destroy(&ctx->termset);
+	ctx->termset = termset;
+	has_termset = 0;
+
+	// match the arrays to the new capacity, as context_count expects
+	size = (size_t)(termset.nitem_max ? termset.nitem_max : 1);
+	TRY_ALLOC(count = corpus_realloc(ctx->count, size * sizeof(*count)));
+	ctx->count = count;
+	TRY_ALLOC(support = corpus_realloc(ctx->support,
+					   size * sizeof(*support)));
+	ctx->support = support;
+out:
+	if (has_termset) {
+		corpus_termset_destroy(&termset);
+	}
+	return err;
+}
+
+
+// prune the term table if it has too many terms, then spill when the
+// tables reach half the budget, leaving room for the buffer
+static void context_check_size(struct context *ctx)
+{
+	int err = 0;
+
+	TRY(context_prune(ctx));
+	if (ctx->has_spill && context_size(ctx) > ctx->memory_limit / 2) {
+		context_spill(ctx);
 	}
+out:
+	CHECK_ERROR(err);
+}
+
+
+static void term_iter_start(struct term_iter *it, struct context *ctx)
+{
+	int err = 0;
+
+	it->ctx = ctx;
+	it->index = -1;
+
+	if (ctx->spilled) {
+		if (ctx->has_merge) {
+			spill_merge_destroy(&ctx->merge);
+			ctx->has_merge = 0;
+		}
+		TRY(spill_merge_start(&ctx->merge, &ctx->spill));
+		ctx->has_merge = 1;
+	}
+out:
+	CHECK_ERROR_MESSAGE(err, "failed reading spilled term counts");
+}
+
+
+static int term_iter_advance(struct term_iter *it)
+{
+	struct context *ctx = it->ctx;
+	const struct corpus_termset_term *term;
+	int err = 0;
+
+	if (ctx->spilled) {
+		if (!spill_merge_advance(&ctx->merge)) {
+			TRY(ctx->merge.error);
+			return 0;
+		}
+		it->index++;
+		it->type_ids = ctx->merge.type_ids;
+		it->length = ctx->merge.current->length;
+		it->count = ctx->merge.current->count;
+		it->support = ctx->merge.current->support;
+		return 1;
+	}
+
+	if (it->index + 1 >= ctx->termset.nitem) {
+		return 0;
+	}
+	it->index++;
+	term = &ctx->termset.items[it->index];
+	it->type_ids = term->type_ids;
+	it->length = term->length;
+	it->count = ctx->count[it->index];
+	it->support = ctx->support[it->index];
+	return 1;
+out:
+	CHECK_ERROR_MESSAGE(err, "failed reading spilled term counts");
+	return 0;
+}
+
 
+/*
+ * The output is in descending order of support, then count, with ties
+ * broken by the term's bytes (the order of R's radix sort, which uses the
+ * C locale). We gather the terms that pass the bounds, sort them here, and
+ * build the R vectors in order.
+ */
+struct term_entry {
+	double count;
+	double support;
+	R_xlen_t off; // offset of the type ids in the id buffer
+	int length;
+};
+
+// the bytes of a term's string: its types, separated by spaces
+struct term_bytes {
+	const int *ids;
+	int length;
+	int index;
+	const uint8_t *ptr;
+	const uint8_t *end;
+};
+
+// qsort has no context argument; only the main thread sorts
+static const struct corpus_symtab_type *sort_types;
+static const int *sort_ids;
+
+
+static void term_bytes_start(struct term_bytes *it, const int *ids,
+			     int length)
+{
+	it->ids = ids;
+	it->length = length;
+	it->index = 0;
+	it->ptr = sort_types[ids[0]].text.ptr;
+	it->end = it->ptr + UTF8LITE_TEXT_SIZE(&sort_types[ids[0]].text);
+}
+
+
+// the next byte, or -1 at the end
+static int term_bytes_next(struct term_bytes *it)
+{
+	const struct utf8lite_text *type;
+
+	if (it->ptr != it->end) {
+		return *it->ptr++;
+	}
+	if (it->index + 1 == it->length) {
+		return -1;
+	}
+
+	it->index++;
+	type = &sort_types[it->ids[it->index]].text;
+	it->ptr = type->ptr;
+	it->end = it->ptr + UTF8LITE_TEXT_SIZE(type);
+	return ' ';
+}
+
+
+static int term_entry_cmp(const void *x1, const void *x2)
+{
+	const struct term_entry *e1 = x1, *e2 = x2;
+	struct term_bytes it1, it2;
+	int c1, c2;
+
+	if (e1->support != e2->support) {
+		return (e1->support > e2->support) ? -1 : 1;
+	}
+	if (e1->count != e2->count) {
+		return (e1->count > e2->count) ? -1 : 1;
+	}
+
+	term_bytes_start(&it1, sort_ids + e1->off, e1->length);
+	term_bytes_start(&it2, sort_ids + e2->off, e2->length);
+	do {
+		c1 = term_bytes_next(&it1);
+		c2 = term_bytes_next(&it2);
+	} while (c1 == c2 && c1 >= 0);
+
+	if (c1 != c2) {
+		return (c1 > c2) ? 1 : -1;
+	}
+
+	// equal bytes, for example with a space connector; keep the table
+	// order, as the stable radix order() did
+	return (e1->off > e2->off) - (e1->off < e2->off);
+}
+
+
+static SEXP context_output(struct context *ctx,
+			   const struct corpus_filter *filter,
+			   double min_count, double max_count,
+			   double min_support, double max_support,
+			   int output_types)
+{
+	SEXP ans = R_NilValue, sterm, scount, ssupport, sclass, snames,
+	     srow_names, stype = NA_STRING;
+	SEXP *stypes;
+	const struct utf8lite_text *type = NULL;
+	const struct term_entry *entry;
+	struct term_entry *entries;
+	struct term_iter term;
+	struct mkchar mkchar;
+	double count, supp;
+	int *ids;
+	const int *type_ids;
+	R_xlen_t i, iterm, nterm, nterm_max, nid, nid_max;
+	int off, len, j, type_id, err = 0, nprot = 0;
+
+	TRACE_BEGIN("term_stats:output");
+
+	// gather the terms within the bounds
 	nterm = 0;
-	for (i = 0; i < ctx->termset.nitem; i++) {
-		RCORPUS_CHECK_INTERRUPT(i);
+	nterm_max = 256;
+	entries = (void *)R_alloc(nterm_max, sizeof(*entries));
+	nid = 0;
+	nid_max = 256 * ctx->ngram_max;
+	ids = (void *)R_alloc(nid_max, sizeof(*ids));
 
-		term = &ctx->termset.items[i];
-		count = ctx->count[i];
-		supp = ctx->support[i];
+	term_iter_start(&term, ctx);
+	while (term_iter_advance(&term)) {
+		RCORPUS_CHECK_INTERRUPT(term.index);
+
+		count = term.count;
+		supp = term.support;
 
 		if (!(min_count <= count && count <= max_count)) {
 			continue;
@@ -239,9 +580,36 @@ SEXP term_stats(SEXP sx, SEXP sngrams, SEXP smin_count, SEXP smax_count,
 				 (uint64_t)R_XLEN_T_MAX);
 			goto out;
 		}
+
+		if (nterm == nterm_max) {
+			entries = (void *)S_realloc((char *)entries,
+						    2 * nterm_max, nterm_max,
+						    sizeof(*entries));
+			nterm_max *= 2;
+		}
+		while (nid + term.length > nid_max) {
+			ids = (void *)S_realloc((char *)ids, 2 * nid_max,
+						nid_max, sizeof(*ids));
+			nid_max *= 2;
+		}
+
+		assert(term.length <= ctx->ngram_max);
+
+		entries[nterm].count = count;
+		entries[nterm].support = supp;
+		entries[nterm].off = nid;
+		entries[nterm].length = term.length;
+		memcpy(ids + nid, term.type_ids, term.length * sizeof(*ids));
+		nid += term.length;
 		nterm++;
 	}
 
+	TRACE_BEGIN("term_stats:sort");
+	sort_types = filter->symtab.types;
+	sort_ids = ids;
+	qsort(entries, (size_t)nterm, sizeof(*entries), term_entry_cmp);
+	TRACE_END("term_stats:sort");
+
 	PROTECT(sterm = allocVector(STRSXP, nterm)); nprot++;
 	if (output_types) {
 		stypes = (void *)R_alloc(ctx->ngram_max, sizeof(*stypes));
@@ -260,27 +628,15 @@ SEXP term_stats(SEXP sx, SEXP sngrams, SEXP smin_count, SEXP smax_count,
 	PROTECT(ssupport = allocVector(REALSXP, nterm)); nprot++;
 
 	mkchar_init(&mkchar);
-	iterm = 0;
-	
-	for (i = 0; i < ctx->termset.nitem; i++) {
-		RCORPUS_CHECK_INTERRUPT(i);
-
-		term = &ctx->termset.items[i];
-		count = ctx->count[i];
-		supp = ctx->support[i];
-
-		if (!(min_count <= count && count <= max_count)) {
-			continue;
-		}
 
-		if (!(min_support <= supp && supp <= max_support)) {
-			continue;
-		}
+	for (iterm = 0; iterm < nterm; iterm++) {
+		RCORPUS_CHECK_INTERRUPT(iterm);
 
-		assert(term->length <= ctx->ngram_max);
+		entry = &entries[iterm];
+		type_ids = ids + entry->off;
 
-		for (j = 0; j < term->length; j++) {
-			type_id = term->type_ids[j];
+		for (j = 0; j < entry->length; j++) {
+			type_id = type_ids[j];
 			type = &filter->symtab.types[type_id].text;
 
 			if (output_types) {
@@ -292,12 +648,12 @@ SEXP term_stats(SEXP sx, SEXP sngrams, SEXP smin_count, SEXP smax_count,
 				utf8lite_render_char(&ctx->render, ' ');
 			}
 
-			if (term->length > 1) {
+			if (entry->length > 1) {
 				utf8lite_render_text(&ctx->render, type);
 			}
 		}
 
-		if (term->length == 1) {
+		if (entry->length == 1) {
 			if (!output_types) {
 				stype = mkchar_get(&mkchar, type);
 			}
@@ -311,9 +667,8 @@ SEXP term_stats(SEXP sx, SEXP sngrams, SEXP smin_count, SEXP smax_count,
 			utf8lite_render_clear(&ctx->render);
 		}
 
-		REAL(scount)[iterm] = count;
-		REAL(ssupport)[iterm] = supp;
-		iterm++;
+		REAL(scount)[iterm] = entry->count;
+		REAL(ssupport)[iterm] = entry->support;
 	}
 
 	len = 3 + (output_types ? ctx->ngram_max : 0);
@@ -358,6 +713,94 @@ SEXP term_stats(SEXP sx, SEXP sngrams, SEXP smin_count, SEXP smax_count,
 	SET_STRING_ELT(sclass, 0, mkChar("corpus_frame"));
 	SET_STRING_ELT(sclass, 1, mkChar("data.frame"));
 	setAttrib(ans, R_ClassSymbol, sclass);
+	TRACE_END("term_stats:output");
+
+out:
+	CHECK_ERROR(err);
+	UNPROTECT(nprot);
+	return ans;
+}
+
+
+SEXP term_stats(SEXP sx, SEXP sngrams, SEXP smin_count, SEXP smax_count,
+		SEXP smin_support, SEXP smax_support, SEXP soutput_types,
+		SEXP ssupport_unit, SEXP swindow, SEXP svocab_limit,
+		SEXP smemory_limit, SEXP sspill_dir)
+{
+	SEXP ans = R_NilValue, sctx, stext;
+	struct context *ctx;
+	const struct utf8lite_text *text;
+	struct corpus_filter *filter;
+	struct corpus_sentfilter *sentfilter = NULL;
+	const char *support_unit;
+	double min_count, max_count, min_support, max_support;
+	R_xlen_t i, n;
+	int output_types, window;
+	int err = 0, nprot = 0;
+
+	PROTECT(stext = coerce_text(sx)); nprot++;
+	text = as_text(stext, &n);
+	filter = text_filter(stext);
+
+	if (sngrams != R_NilValue) {
+		PROTECT(sngrams = coerceVector(sngrams, INTSXP)); nprot++;
+	}
+
+	min_count = smin_count == R_NilValue ? -INFINITY : REAL(smin_count)[0];
+	max_count = smax_count == R_NilValue ? INFINITY : REAL(smax_count)[0];
+
+	min_support = (smin_support == R_NilValue ? -INFINITY
+						  : REAL(smin_support)[0]);
+	max_support = (smax_support == R_NilValue ? INFINITY
+						  : REAL(smax_support)[0]);
+
+	output_types = (LOGICAL(soutput_types)[0] == TRUE);
+
+	support_unit = CHAR(STRING_ELT(ssupport_unit, 0));
+	if (strcmp(support_unit, "sentence") == 0) {
+		sentfilter = text_sentfilter(stext);
+	}
+	window = (swindow == R_NilValue) ? 0 : INTEGER(swindow)[0];
+
+	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy)); nprot++;
+        ctx = as_context(sctx);
+	context_init(ctx, sngrams);
+	ctx->vocab_limit = (svocab_limit == R_NilValue ? 0
+			    : INTEGER(svocab_limit)[0]);
+	context_set_spill(ctx, smemory_limit, sspill_dir);
+
+	TRACE_BEGIN("term_stats:scan");
+	for (i = 0; i < n; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+
+		if (!sentfilter) {
+			context_scan(ctx, filter, &text[i], window);
+			context_check_size(ctx);
+			continue;
+		}
+
+		if (!text[i].ptr || UTF8LITE_TEXT_SIZE(&text[i]) == 0) {
+			continue;
+		}
+
+		TRY(corpus_sentfilter_start(sentfilter, &text[i]));
+		while (corpus_sentfilter_advance(sentfilter)) {
+			context_scan(ctx, filter, &sentfilter->current, 0);
+		}
+		TRY(sentfilter->error);
+		context_check_size(ctx);
+	}
+	TRACE_END("term_stats:scan");
+
+	// if we spilled, put the rest on disk too and merge from there
+	if (ctx->spilled) {
+		context_spill(ctx);
+		TRY(spill_finish(&ctx->spill));
+	}
+
+	PROTECT(ans = context_output(ctx, filter, min_count, max_count,
+				     min_support, max_support, output_types));
+	nprot++;
 
 out:
 	CHECK_ERROR(err);
@@ -365,3 +808,281 @@ out:
 	UNPROTECT(nprot);
 	return ans;
 }
+
+
+/*
+ * Term statistics straight from an NDJSON file. The pipeline threads read
+ * the file and extract the text field; the main thread tokenizes, since the
+ * filter (and any stemmer written in R) must stay there; and a separate
+ * thread counts the n-grams. The main thread passes the type ids to the
+ * counting thread in chunks, with TOKEN_BREAK for an n-gram boundary and
+ * TOKEN_END at the end of each text.
+ */
+
+#define TOKEN_BREAK (-1)
+#define TOKEN_END (-2)
+
+struct chunk {
+	int *ids;
+	size_t nid;
+	size_t nid_max;
+};
+
+struct ingest {
+	struct context counts;
+	struct ndjson_pipeline *pipeline;
+	struct queue *queue;
+	pthread_t counter;
+	int has_counter;
+	int err;
+};
+
+
+static void chunk_free(struct chunk *c)
+{
+	if (c) {
+		corpus_free(c->ids);
+		corpus_free(c);
+	}
+}
+
+
+static int chunk_push(struct chunk *c, int id)
+{
+	int *ids;
+	size_t max;
+
+	if (c->nid == c->nid_max) {
+		max = c->nid_max ? 2 * c->nid_max : 4096;
+		if (!(ids = corpus_realloc(c->ids, max * sizeof(*ids)))) {
+			return CORPUS_ERROR_NOMEM;
+		}
+		c->ids = ids;
+		c->nid_max = max;
+	}
+	c->ids[c->nid++] = id;
+	return 0;
+}
+
+
+static int chunk_count(struct context *ctx, const struct chunk *c)
+{
+	size_t i;
+	int id, err = 0;
+
+	for (i = 0; i < c->nid; i++) {
+		id = c->ids[i];
+		if (id >= 0) {
+			TRY(corpus_ngram_add(&ctx->ngram, id, 1));
+		} else {
+			TRY(corpus_ngram_break(&ctx->ngram));
+			if (id == TOKEN_END) {
+				TRY(context_count(ctx, 1));
+			}
+		}
+	}
+out:
+	return err;
+}
+
+
+// after an error, keep draining the queue so the main thread never blocks
+static void *counter_work(void *arg)
+{
+	struct ingest *ing = arg;
+	void *item;
+	int err = 0;
+
+	while (queue_pop(ing->queue, &item)) {
+		if (!err) {
+			TRACE_BEGIN("term_stats:count");
+			if (!(err = chunk_count(&ing->counts, item))) {
+				err = context_prune(&ing->counts);
+			}
+			TRACE_END("term_stats:count");
+		}
+		chunk_free(item);
+	}
+
+	ing->err = err;
+	return NULL;
+}
+
+
+// stop the threads; after this, the main thread owns the counts
+static void ingest_stop(struct ingest *ing)
+{
+	if (ing->pipeline) {
+		ndjson_pipeline_close(ing->pipeline);
+		ing->pipeline = NULL;
+	}
+	if (ing->queue) {
+		queue_close(ing->queue);
+	}
+	if (ing->has_counter) {
+		pthread_join(ing->counter, NULL);
+		ing->has_counter = 0;
+	}
+	queue_free(ing->queue);
+	ing->queue = NULL;
+}
+
+
+// stop the threads, then report the pipeline's error
+static void ingest_fail(struct ingest *ing)
+{
+	char message[256];
+
+	snprintf(message, sizeof(message), "%s", ing->pipeline
+		 ? ndjson_pipeline_message(ing->pipeline)
+		 : "failed allocating memory");
+	ingest_stop(ing);
+	error("%s", message);
+}
+
+
+static void ingest_destroy(void *obj)
+{
+	struct ingest *ing = obj;
+
+	ingest_stop(ing);
+	context_destroy(&ing->counts);
+}
+
+
+static int ingest_scan(struct ingest *ing, struct corpus_filter *filter,
+		       const struct ndjson_batch *batch)
+{
+	struct chunk *c;
+	R_xlen_t i;
+	int type_id, err = 0;
+
+	TRY_ALLOC(c = corpus_calloc(1, sizeof(*c)));
+
+	for (i = 0; i < batch->ntext; i++) {
+		if (!batch->text[i].ptr) {
+			continue;
+		}
+
+		TRY(corpus_filter_start(filter, &batch->text[i]));
+		while (corpus_filter_advance(filter)) {
+			type_id = filter->type_id;
+			if (type_id == CORPUS_TYPE_NONE) {
+				continue;
+			} else if (type_id < 0) {
+				TRY(chunk_push(c, TOKEN_BREAK));
+			} else {
+				TRY(chunk_push(c, type_id));
+			}
+		}
+		TRY(filter->error);
+		TRY(chunk_push(c, TOKEN_END));
+	}
+
+	// the queue only closes early if we stop it ourselves
+	if (queue_push(ing->queue, c)) {
+		err = CORPUS_ERROR_INVAL;
+		goto out;
+	}
+	c = NULL;
+out:
+	chunk_free(c);
+	return err;
+}
+
+
+SEXP term_stats_ndjson(SEXP sfile, SEXP sfield, SEXP sx, SEXP sngrams,
+		       SEXP smin_count, SEXP smax_count, SEXP smin_support,
+		       SEXP smax_support, SEXP soutput_types, SEXP svocab_limit,
+		       SEXP sthreads)
+{
+	SEXP ans = R_NilValue, sctx, stext;
+	struct ingest *ing;
+	const struct ndjson_batch *batch;
+	struct corpus_filter *filter;
+	const char *path, *field;
+	double min_count, max_count, min_support, max_support;
+	R_xlen_t nbatch = 0;
+	int output_types, nthread, err = 0, nprot = 0;
+
+	PROTECT(stext = coerce_text(sx)); nprot++;
+	as_text(stext, NULL); // load the handle before building the filter
+	filter = text_filter(stext);
+
+	path = R_ExpandFileName(translateChar(STRING_ELT(sfile, 0)));
+	field = translateCharUTF8(STRING_ELT(sfield, 0));
+
+	if (sngrams != R_NilValue) {
+		PROTECT(sngrams = coerceVector(sngrams, INTSXP)); nprot++;
+	}
+
+	min_count = smin_count == R_NilValue ? -INFINITY : REAL(smin_count)[0];
+	max_count = smax_count == R_NilValue ? INFINITY : REAL(smax_count)[0];
+
+	min_support = (smin_support == R_NilValue ? -INFINITY
+						  : REAL(smin_support)[0]);
+	max_support = (smax_support == R_NilValue ? INFINITY
+						  : REAL(smax_support)[0]);
+
+	output_types = (LOGICAL(soutput_types)[0] == TRUE);
+
+	if (sthreads == R_NilValue) {
+		nthread = default_threads();
+	} else {
+		nthread = INTEGER(sthreads)[0];
+		if (nthread == NA_INTEGER || nthread < 1) {
+			error("invalid 'threads' argument");
+		}
+	}
+
+	PROTECT(sctx = alloc_context(sizeof(*ing), ingest_destroy)); nprot++;
+	ing = as_context(sctx);
+	context_init(&ing->counts, sngrams);
+	ing->counts.vocab_limit = (svocab_limit == R_NilValue ? 0
+				   : INTEGER(svocab_limit)[0]);
+
+	TRY(queue_open(&ing->queue, 4));
+	if ((err = ndjson_pipeline_open(&ing->pipeline, path, field, nthread,
+					2 * nthread + 2))) {
+		ingest_fail(ing);
+	}
+	if (pthread_create(&ing->counter, NULL, counter_work, ing)) {
+		ingest_stop(ing);
+		error("failed starting threads");
+	}
+	ing->has_counter = 1;
+
+	TRACE_BEGIN("term_stats:scan");
+	for (;;) {
+		RCORPUS_CHECK_INTERRUPT(nbatch);
+		nbatch++;
+
+		if ((err = ndjson_pipeline_next(ing->pipeline, &batch))) {
+			TRACE_END("term_stats:scan");
+			ingest_fail(ing);
+		}
+		if (!batch) {
+			break;
+		}
+		TRY(ingest_scan(ing, filter, batch));
+	}
+	TRACE_END("term_stats:scan");
+
+	// wait for the counting thread to catch up
+	ingest_stop(ing);
+	TRY(ing->err);
+
+	PROTECT(ans = context_output(&ing->counts, filter, min_count,
+				     max_count, min_support, max_support,
+				     output_types));
+	nprot++;
+
+out:
+	if (err) {
+		ingest_stop(ing);
+	}
+	CHECK_ERROR(err);
+	free_context(sctx);
+	UNPROTECT(nprot);
+	return ans;
+}
@@ -25,7 +25,8 @@
 enum source_type {
 	SOURCE_NONE = 0,
 	SOURCE_CHAR,
-	SOURCE_JSON
+	SOURCE_JSON,
+	SOURCE_RAW
 };
 
 
@@ -34,6 +35,7 @@ struct source {
 	union {
 		const struct json *set;
 		SEXP chars;
+		SEXP bytes;
 	} data;
 	R_xlen_t nrow;
 };
@@ -41,7 +43,8 @@ struct source {
 
 static int is_source(SEXP x)
 {
-	return (x == R_NilValue || TYPEOF(x) == STRSXP || is_json(x));
+	return (x == R_NilValue || TYPEOF(x) == STRSXP || TYPEOF(x) == RAWSXP
+		|| is_json(x));
 }
 
 
@@ -58,9 +61,14 @@ static void source_assign(struct source *source, SEXP value)
 		source->type = SOURCE_JSON;
 		source->data.set = as_json(value);
 		source->nrow = source->data.set->nrow;
+	} else if (TYPEOF(value) == RAWSXP) {
+		// a single row of UTF-8 bytes
+		source->type = SOURCE_RAW;
+		source->data.bytes = value;
+		source->nrow = 1;
 	} else {
 		error("invalid text source;"
-		      " should be 'character', 'json', or NULL");
+		      " should be 'character', 'json', 'raw', or NULL");
 	}
 }
 
@@ -138,7 +146,8 @@ SEXP alloc_text(SEXP sources, SEXP source, SEXP row, SEXP start, SEXP stop,
 		src = VECTOR_ELT(sources, s);
 		if (!is_source(src)) {
 			error("'sources' element at index %d is invalid;"
-			      "should be a 'character' or 'json'", s + 1);
+			      " should be a 'character', 'json', or 'raw'",
+			      s + 1);
 		}
 	}
 
@@ -419,8 +428,6 @@ SEXP coerce_text(SEXP sx)
 static void load_text(SEXP x)
 {
 	SEXP shandle, srow, ssource, sstart, sstop, ssources, src, str, stable;
-	const double *row;
-	const int *source, *start, *stop;
 	struct rcorpus_text *obj;
 	struct utf8lite_text txt;
 	struct utf8lite_message msg;
@@ -428,7 +435,7 @@ static void load_text(SEXP x)
 	const uint8_t *ptr;
 	double r;
 	R_xlen_t i, j, len, nrow;
-	int err = 0, s, nsrc, begin, end, flags = 0;
+	int err = 0, s, nsrc, start, stop, begin, end, flags = 0;
 
 	shandle = getListElement(x, "handle");
 
@@ -470,11 +477,6 @@ static void load_text(SEXP x)
 		error("invalid 'stop' argument");
 	}
 
-	source = INTEGER(ssource);
-	row = REAL(srow);
-	start = INTEGER(sstart);
-	stop = INTEGER(sstop);
-
 	R_RegisterCFinalizerEx(shandle, free_text, TRUE);
 	TRY_ALLOC(obj = corpus_calloc(1, sizeof(*obj)));
 	R_SetExternalPtrAddr(shandle, obj);
@@ -487,14 +489,16 @@ static void load_text(SEXP x)
 	for (i = 0; i < nrow; i++) {
 		RCORPUS_CHECK_INTERRUPT(i);
 
-		s = source[i];
+		// use element access so that compact (ALTREP) tables
+		// don't get expanded
+		s = INTEGER_ELT(ssource, i);
 		if (!(1 <= s && s <= nsrc)) {
 			error("source[[%"PRIu64"]] (%d) is out of range",
 				(uint64_t)i + 1, s);
 		}
 		s--; // switch to 0-based index
 
-		r = row[i];
+		r = REAL_ELT(srow, i);
 		if (!(1 <= r && r <= sources[s].nrow)) {
 			error("row[[%"PRIu64"]] (%g) is out of range",
 				(uint64_t)i + 1, r);
@@ -502,7 +506,9 @@ static void load_text(SEXP x)
 		j = (R_xlen_t)(r - 1);
 
 		// handle NA range
-		if (start[i] == NA_INTEGER || stop[i] == NA_INTEGER) {
+		start = INTEGER_ELT(sstart, i);
+		stop = INTEGER_ELT(sstop, i);
+		if (start == NA_INTEGER || stop == NA_INTEGER) {
 			obj->text[i].ptr = NULL;
 			obj->text[i].attr = 0;
 			continue;
@@ -536,6 +542,13 @@ static void load_text(SEXP x)
 			flags = UTF8LITE_TEXT_UNESCAPE;
 			break;
 
+		case SOURCE_RAW:
+			// validated below, when we assign the span
+			txt.ptr = RAW(sources[s].data.bytes);
+			txt.attr = (size_t)XLENGTH(sources[s].data.bytes);
+			flags = 0;
+			break;
+
 		default:
 			txt.ptr = NULL;
 			txt.attr = 0;
@@ -543,8 +556,8 @@ static void load_text(SEXP x)
 			break;
 		}
 
-		begin = (start[i] < 1) ? 0 : (start[i] - 1);
-		end = stop[i] < start[i] ? begin : stop[i];
+		begin = (start < 1) ? 0 : (start - 1);
+		end = stop < start ? begin : stop;
 		if ((size_t)end > UTF8LITE_TEXT_SIZE(&txt)) {
 			end = (int)UTF8LITE_TEXT_SIZE(&txt);
 		}
@@ -552,8 +565,12 @@ static void load_text(SEXP x)
 		// this could be made more efficient; add a
 		// 'can_break?' function to corpus/text.h
 		err = utf8lite_text_assign(&obj->text[i], txt.ptr + begin,
-					   end - begin, flags, NULL);
-		if (err) {
+					   end - begin, flags, &msg);
+		if (err && sources[s].type == SOURCE_RAW) {
+			error("raw object in source %d"
+			      " contains malformed UTF-8: %s",
+			      s + 1, msg.string);
+		} else if (err) {
 			error("text span in row[[%"PRIu64"]]"
 			      " starts or ends in the middle"
 			      " of a multi-byte character", i + 1);
@@ -595,21 +612,21 @@ SEXP as_character_text(SEXP x)
 	PROTECT(ans = allocVector(STRSXP, n));
 	for (i = 0; i < n; i++) {
 		RCORPUS_CHECK_INTERRUPT(i);
-		s = INTEGER(source)[i] - 1;
+		s = INTEGER_ELT(source, i) - 1;
 
 		// if the source is character, we might be able to use that
 		// instead of allocating a new object
 		alloc = 1;
 		if (is_char[s]) {
-			r = (R_xlen_t)(REAL(row)[i] - 1);
+			r = (R_xlen_t)(REAL_ELT(row, i) - 1);
 			src = VECTOR_ELT(sources, s);
 			str = STRING_ELT(src, r);
 
 			if (str == NA_STRING) {
 				alloc = 0;
-			} else if (INTEGER(start)[i] == 1) {
+			} else if (INTEGER_ELT(start, i) == 1) {
 				len = LENGTH(str);
-				if (INTEGER(stop)[i] == len) {
+				if (INTEGER_ELT(stop, i) == len) {
 					alloc = 0;
 				}
 			}
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "rcorpus.h"
+
+/*
+ * Comparison operators for text, in code point order (the same order
+ * used by xtfrm). We compare the bytes in place, decoding only the texts
+ * that contain escapes.
+ */
+
+enum compare_op {
+	COMPARE_EQ = 0,
+	COMPARE_NE,
+	COMPARE_LT,
+	COMPARE_LE,
+	COMPARE_GT,
+	COMPARE_GE
+};
+
+
+static int compare_escaped(const struct utf8lite_text *t1,
+			   const struct utf8lite_text *t2)
+{
+	struct utf8lite_text_iter it1, it2;
+	int has1, has2;
+
+	utf8lite_text_iter_make(&it1, t1);
+	utf8lite_text_iter_make(&it2, t2);
+
+	for (;;) {
+		has1 = utf8lite_text_iter_advance(&it1);
+		has2 = utf8lite_text_iter_advance(&it2);
+
+		if (!has1 || !has2) {
+			return has1 - has2;
+		}
+		if (it1.current != it2.current) {
+			return (it1.current < it2.current) ? -1 : 1;
+		}
+	}
+}
+
+
+static int compare_text(const struct utf8lite_text *t1,
+			const struct utf8lite_text *t2)
+{
+	size_t n1 = UTF8LITE_TEXT_SIZE(t1), n2 = UTF8LITE_TEXT_SIZE(t2);
+	size_t n = n1 < n2 ? n1 : n2;
+	int cmp;
+
+	if (UTF8LITE_TEXT_HAS_ESC(t1) || UTF8LITE_TEXT_HAS_ESC(t2)) {
+		// same bytes, same escapes
+		if (t1->ptr == t2->ptr && t1->attr == t2->attr) {
+			return 0;
+		}
+		return compare_escaped(t1, t2);
+	}
+
+	// same span of the same source
+	if (t1->ptr == t2->ptr) {
+		return (n1 > n2) - (n1 < n2);
+	}
+
+	if (n > 0 && (cmp = memcmp(t1->ptr, t2->ptr, n))) {
+		return cmp;
+	}
+	return (n1 > n2) - (n1 < n2);
+}
+
+
+static int equal_text(const struct utf8lite_text *t1,
+		      const struct utf8lite_text *t2)
+{
+	size_t n1 = UTF8LITE_TEXT_SIZE(t1), n2 = UTF8LITE_TEXT_SIZE(t2);
+
+	if (UTF8LITE_TEXT_HAS_ESC(t1) || UTF8LITE_TEXT_HAS_ESC(t2)) {
+		return compare_text(t1, t2) == 0;
+	}
+
+	// a cheaper test than ordering: check the sizes first
+	if (n1 != n2) {
+		return 0;
+	}
+	return (t1->ptr == t2->ptr || n1 == 0
+		|| memcmp(t1->ptr, t2->ptr, n1) == 0);
+}
+
+
+SEXP text_compare(SEXP se1, SEXP se2, SEXP sop)
+{
+	SEXP ans;
+	const struct utf8lite_text *e1, *e2, *t1, *t2;
+	R_xlen_t i, i1, i2, n, n1, n2;
+	int *res, op, cmp, nprot = 0;
+
+	PROTECT(se1 = coerce_text(se1)); nprot++;
+	PROTECT(se2 = coerce_text(se2)); nprot++;
+	e1 = as_text(se1, &n1);
+	e2 = as_text(se2, &n2);
+	op = INTEGER(sop)[0];
+
+	if (n1 == 0 || n2 == 0) {
+		n = 0;
+	} else {
+		n = n1 > n2 ? n1 : n2;
+	}
+
+	PROTECT(ans = allocVector(LGLSXP, n)); nprot++;
+	res = LOGICAL(ans);
+
+	i1 = 0;
+	i2 = 0;
+	for (i = 0; i < n; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+
+		t1 = &e1[i1];
+		t2 = &e2[i2];
+
+		// recycle without copying
+		if (++i1 == n1) {
+			i1 = 0;
+		}
+		if (++i2 == n2) {
+			i2 = 0;
+		}
+
+		if (!t1->ptr || !t2->ptr) {
+			res[i] = NA_LOGICAL;
+			continue;
+		}
+
+		switch (op) {
+		case COMPARE_EQ:
+			res[i] = equal_text(t1, t2);
+			break;
+
+		case COMPARE_NE:
+			res[i] = !equal_text(t1, t2);
+			break;
+
+		default:
+			cmp = compare_text(t1, t2);
+			switch (op) {
+			case COMPARE_LT:
+				res[i] = (cmp < 0);
+				break;
+			case COMPARE_LE:
+				res[i] = (cmp <= 0);
+				break;
+			case COMPARE_GT:
+				res[i] = (cmp > 0);
+				break;
+			default:
+				res[i] = (cmp >= 0);
+				break;
+			}
+			break;
+		}
+	}
+
+	UNPROTECT(nprot);
+	return ans;
+}
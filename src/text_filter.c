@@ -14,6 +14,9 @@
  * limitations under the License.
  */
 
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
 #include "rcorpus.h"
 
 
@@ -91,6 +94,12 @@ SEXP as_text_filter_connector(SEXP value)
 }
 
 
+int text_type_kind(SEXP x)
+{
+	return filter_type_kind(getListElement(x, "filter"));
+}
+
+
 static int32_t filter_connector(SEXP filter)
 {
 	SEXP value, con;
@@ -201,11 +210,40 @@ static int add_combine(void *obj, const struct utf8lite_text *x)
 }
 
 
+static void text_filter_stemmer(struct rcorpus_text *obj, SEXP filter)
+{
+	SEXP stemmer;
+	const char *snowball;
+
+	if (obj->has_stemmer && obj->stemmer.error) {
+		stemmer_destroy(&obj->stemmer);
+		obj->has_stemmer = 0;
+	}
+
+	if (!obj->has_stemmer) {
+		stemmer = getListElement(filter, "stemmer");
+		
+		if (stemmer == R_NilValue) {
+			stemmer_init_none(&obj->stemmer);
+		} else if (TYPEOF(stemmer) == STRSXP) {
+			snowball = filter_stemmer_snowball(stemmer);
+			stemmer_init_snowball(&obj->stemmer, snowball);
+		} else if (isFunction(stemmer)) {
+			stemmer_init_rfunc(&obj->stemmer, stemmer,
+					   R_GlobalEnv);
+		} else {
+			error("invalid filter 'stemmer' value");
+		}
+
+		obj->has_stemmer = 1;
+	}
+}
+
+
 struct corpus_filter *text_filter(SEXP x)
 {
-	SEXP handle, filter, combine, stemmer;
+	SEXP handle, filter, combine;
 	struct rcorpus_text *obj;
-	const char *snowball;
 	int32_t connector;
 	int err = 0, nprot = 0, type_kind, flags, stem_dropped;
 
@@ -231,6 +269,7 @@ struct corpus_filter *text_filter(SEXP x)
 	}
 	obj->valid_filter = 0;
 
+	TRACE_BEGIN("text_filter");
 	filter = getListElement(x, "filter");
 	type_kind = filter_type_kind(filter);
 	combine = getListElement(filter, "combine");
@@ -238,28 +277,7 @@ struct corpus_filter *text_filter(SEXP x)
 	flags = filter_flags(filter);
 	stem_dropped = filter_logical(filter, "stem_dropped", 0);
 
-	if (obj->has_stemmer && obj->stemmer.error) {
-		stemmer_destroy(&obj->stemmer);
-		obj->has_stemmer = 0;
-	}
-
-	if (!obj->has_stemmer) {
-		stemmer = getListElement(filter, "stemmer");
-		
-		if (stemmer == R_NilValue) {
-			stemmer_init_none(&obj->stemmer);
-		} else if (TYPEOF(stemmer) == STRSXP) {
-			snowball = filter_stemmer_snowball(stemmer);
-			stemmer_init_snowball(&obj->stemmer, snowball);
-		} else if (isFunction(stemmer)) {
-			stemmer_init_rfunc(&obj->stemmer, stemmer,
-					   R_GlobalEnv);
-		} else {
-			error("invalid filter 'stemmer' value");
-		}
-
-		obj->has_stemmer = 1;
-	}
+	text_filter_stemmer(obj, filter);
 
 	TRY(corpus_filter_init(&obj->filter, flags, type_kind,
 			       connector, obj->stemmer.stem_func,
@@ -277,6 +295,7 @@ add_terms(add_drop, &obj->filter,
 	add_terms(add_drop_except, &obj->filter,
 		  getListElement(filter, "drop_except"));
 	add_terms(add_combine, &obj->filter, combine);
+	TRACE_END("text_filter");
 out:
 	UNPROTECT(nprot);
 	CHECK_ERROR(err);
@@ -285,6 +304,58 @@ out:
 }
 
 
+/*
+ * Move the compiled filter from 'x' to 'y', whose filter differs only by
+ * additions to the drop, drop_except, and combine lists, and add those in
+ * place. The symbol table, with its normalized types and stems, carries
+ * over. We move the whole text object, so that 'x' (which may still be in
+ * use) gets a fresh one, and rebuilds its filter if it needs it again.
+ * If there is nothing to move, 'y' builds its filter on first use.
+ */
+SEXP text_filter_patch(SEXP sx, SEXP sy)
+{
+	SEXP xhandle, yhandle, filter;
+	struct rcorpus_text *obj;
+	int stem_dropped;
+
+	xhandle = getListElement(sx, "handle");
+	yhandle = getListElement(sy, "handle");
+	obj = R_ExternalPtrAddr(xhandle);
+
+	if (!obj || R_ExternalPtrAddr(yhandle) || !obj->has_filter
+	    || !obj->valid_filter || obj->filter.error || obj->sealed
+	    || (obj->has_stemmer && obj->stemmer.error)) {
+		return R_NilValue;
+	}
+
+	R_SetExternalPtrAddr(xhandle, NULL);
+	R_SetExternalPtrAddr(yhandle, obj);
+
+	// until we finish, the filter has to get rebuilt
+	obj->valid_filter = 0;
+
+	TRACE_BEGIN("text_filter:patch");
+	filter = getListElement(sy, "filter");
+	stem_dropped = filter_logical(filter, "stem_dropped", 0);
+
+	// same order as when building: drop, then the exceptions
+	if (!stem_dropped) {
+		add_terms(add_stem_except, &obj->filter,
+			  getListElement(filter, "drop"));
+	}
+	add_terms(add_drop, &obj->filter, getListElement(filter, "drop"));
+	add_terms(add_drop_except, &obj->filter,
+		  getListElement(filter, "drop_except"));
+	add_terms(add_combine, &obj->filter, getListElement(filter, "combine"));
+	TRACE_END("text_filter:patch");
+
+	if (!obj->filter.error) {
+		obj->valid_filter = 1;
+	}
+	return R_NilValue;
+}
+
+
 static int sentfilter_flags(SEXP filter)
 {
 	int flags = CORPUS_SENTSCAN_SPCRLF;
@@ -348,3 +419,383 @@ out:
 	obj->valid_sentfilter = 1;
 	return &obj->sentfilter;
 }
+
+
+/*
+ * Saved filters
+ *
+ * A saved filter holds the serialized filter properties, along with the
+ * types in the filter's symbol table and their stems. Loading a saved
+ * filter rebuilds the compiled filter with the stems memoized, so that
+ * the stemmer does not get called again for any of the saved types.
+ *
+ * File layout (native byte order):
+ *
+ *   magic          8 bytes, "CORPUSFT"
+ *   version        uint32
+ *   byte order     uint32, 0x01020304
+ *   spec size      uint64
+ *   spec           serialized filter properties
+ *   ntype          uint32
+ *   has_stems      uint32
+ *   types          for each type: int32 size, bytes; then, if has_stems,
+ *                  int32 stem size (-1 for NA), bytes
+ */
+
+#define FILTER_FILE_MAGIC "CORPUSFT"
+#define FILTER_FILE_VERSION 1
+#define FILTER_FILE_BOM 0x01020304
+
+
+SEXP text_filter_types(SEXP sx)
+{
+	SEXP ans, names, stypes, sstems, str;
+	struct rcorpus_text *obj;
+	struct corpus_filter *filter;
+	const struct utf8lite_text *text;
+	const uint8_t *stem;
+	uint8_t *buf = NULL, *buf2;
+	struct mkchar mk;
+	R_xlen_t i, n;
+	int id, ntype, stemlen, nbuf = 0, nprot = 0, err = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	text = as_text(sx, &n);
+	filter = text_filter(sx);
+	obj = R_ExternalPtrAddr(getListElement(sx, "handle"));
+
+	// add every type in the text to the symbol table
+	for (i = 0; i < n; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+
+		if (!text[i].ptr) {
+			continue;
+		}
+
+		TRY(corpus_filter_start(filter, &text[i]));
+		while (corpus_filter_advance(filter)) {
+		}
+		TRY(filter->error);
+	}
+
+	ntype = filter->symtab.ntype;
+	mkchar_init(&mk);
+
+	PROTECT(stypes = allocVector(STRSXP, ntype)); nprot++;
+	for (id = 0; id < ntype; id++) {
+		RCORPUS_CHECK_INTERRUPT(id);
+		str = mkchar_get(&mk, &filter->symtab.types[id].text);
+		SET_STRING_ELT(stypes, id, str);
+	}
+
+	sstems = R_NilValue;
+	if (obj->stemmer.stem_func) {
+		PROTECT(sstems = allocVector(STRSXP, ntype)); nprot++;
+		for (id = 0; id < ntype; id++) {
+			RCORPUS_CHECK_INTERRUPT(id);
+			str = STRING_ELT(stypes, id);
+			TRY(obj->stemmer.stem_func((const uint8_t *)CHAR(str),
+						   LENGTH(str), &stem,
+						   &stemlen,
+						   obj->stemmer.stem_context));
+			if (stemlen < 0) {
+				SET_STRING_ELT(sstems, id, NA_STRING);
+				continue;
+			}
+
+			// copy the stem before allocating; it might point
+			// to an unprotected R object
+			if (stemlen > nbuf) {
+				TRY_ALLOC(buf2 = corpus_realloc(buf, stemlen));
+				buf = buf2;
+				nbuf = stemlen;
+			}
+			if (stemlen > 0) {
+				memcpy(buf, stem, stemlen);
+			}
+			str = mkCharLenCE((const char *)buf, stemlen, CE_UTF8);
+			SET_STRING_ELT(sstems, id, str);
+		}
+	}
+
+	PROTECT(ans = allocVector(VECSXP, 2)); nprot++;
+	SET_VECTOR_ELT(ans, 0, stypes);
+	SET_VECTOR_ELT(ans, 1, sstems);
+
+	PROTECT(names = allocVector(STRSXP, 2)); nprot++;
+	SET_STRING_ELT(names, 0, mkChar("types"));
+	SET_STRING_ELT(names, 1, mkChar("stems"));
+	setAttrib(ans, R_NamesSymbol, names);
+
+out:
+	corpus_free(buf);
+	CHECK_ERROR(err);
+	UNPROTECT(nprot);
+	return ans;
+}
+
+
+SEXP text_filter_attach(SEXP sx, SEXP stypes, SEXP sstems)
+{
+	SEXP str;
+	struct rcorpus_text *obj;
+	struct corpus_filter *filter;
+	struct stem_memo *memo = NULL;
+	struct utf8lite_text type;
+	struct utf8lite_message msg;
+	R_xlen_t i, n;
+	int id, nprot = 0, err = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	as_text(sx, &n);
+	obj = R_ExternalPtrAddr(getListElement(sx, "handle"));
+
+	if (TYPEOF(stypes) != STRSXP) {
+		error("invalid 'types' argument");
+	}
+	if (sstems != R_NilValue && (TYPEOF(sstems) != STRSXP
+				     || XLENGTH(sstems) != XLENGTH(stypes))) {
+		error("invalid 'stems' argument");
+	}
+
+	// discard the current filter and stemmer
+	if (obj->has_filter) {
+		corpus_filter_destroy(&obj->filter);
+		obj->has_filter = 0;
+	}
+	if (obj->has_stemmer) {
+		stemmer_destroy(&obj->stemmer);
+		obj->has_stemmer = 0;
+	}
+	obj->valid_filter = 0;
+
+	// build the stemmer, with the saved stems in front of it
+	text_filter_stemmer(obj, getListElement(sx, "filter"));
+	if (sstems != R_NilValue) {
+		TRY_ALLOC(memo = corpus_malloc(sizeof(*memo)));
+		TRY(stem_memo_init(memo, stypes, sstems));
+		stemmer_set_memo(&obj->stemmer, memo);
+		memo = NULL;
+	}
+
+	filter = text_filter(sx);
+
+	// restore the symbol table
+	n = XLENGTH(stypes);
+	for (i = 0; i < n; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+
+		str = STRING_ELT(stypes, i);
+		if (str == NA_STRING) {
+			continue;
+		}
+		if (utf8lite_text_assign(&type, (const uint8_t *)CHAR(str),
+					 LENGTH(str), 0, &msg)) {
+			error("saved type at index %"PRIu64
+			      " contains malformed UTF-8: %s",
+			      (uint64_t)i + 1, msg.string);
+		}
+		TRY(corpus_filter_add_type(filter, &type, &id));
+	}
+
+out:
+	corpus_free(memo);
+	CHECK_ERROR(err);
+	UNPROTECT(nprot);
+	return sx;
+}
+
+
+static int write_bytes(FILE *stream, const void *ptr, size_t size)
+{
+	if (size && fwrite(ptr, 1, size, stream) != size) {
+		return CORPUS_ERROR_OS;
+	}
+	return 0;
+}
+
+
+static int write_string(FILE *stream, SEXP str)
+{
+	int32_t size = (str == NA_STRING) ? -1 : LENGTH(str);
+	int err = 0;
+
+	TRY(write_bytes(stream, &size, sizeof(size)));
+	if (size > 0) {
+		TRY(write_bytes(stream, CHAR(str), (size_t)size));
+	}
+out:
+	return err;
+}
+
+
+SEXP text_filter_write(SEXP sfile, SEXP sspec, SEXP stypes, SEXP sstems)
+{
+	FILE *stream;
+	const char *file;
+	uint64_t spec_size;
+	uint32_t version = FILTER_FILE_VERSION, bom = FILTER_FILE_BOM;
+	uint32_t ntype, has_stems;
+	R_xlen_t i;
+	int err = 0;
+
+	if (!(isString(sfile) && LENGTH(sfile) == 1)) {
+		error("invalid 'file' argument");
+	}
+	if (TYPEOF(sspec) != RAWSXP) {
+		error("invalid 'spec' argument");
+	}
+	if (TYPEOF(stypes) != STRSXP || XLENGTH(stypes) > UINT32_MAX) {
+		error("invalid 'types' argument");
+	}
+	if (sstems != R_NilValue && (TYPEOF(sstems) != STRSXP
+				     || XLENGTH(sstems) != XLENGTH(stypes))) {
+		error("invalid 'stems' argument");
+	}
+
+	file = R_ExpandFileName(translateChar(STRING_ELT(sfile, 0)));
+	if (!(stream = fopen(file, "wb"))) {
+		error("cannot open file '%s' for writing", file);
+	}
+
+	spec_size = (uint64_t)XLENGTH(sspec);
+	ntype = (uint32_t)XLENGTH(stypes);
+	has_stems = (sstems != R_NilValue);
+
+	TRY(write_bytes(stream, FILTER_FILE_MAGIC, 8));
+	TRY(write_bytes(stream, &version, sizeof(version)));
+	TRY(write_bytes(stream, &bom, sizeof(bom)));
+	TRY(write_bytes(stream, &spec_size, sizeof(spec_size)));
+	TRY(write_bytes(stream, RAW(sspec), (size_t)spec_size));
+	TRY(write_bytes(stream, &ntype, sizeof(ntype)));
+	TRY(write_bytes(stream, &has_stems, sizeof(has_stems)));
+
+	for (i = 0; i < (R_xlen_t)ntype; i++) {
+		TRY(write_string(stream, STRING_ELT(stypes, i)));
+		if (has_stems) {
+			TRY(write_string(stream, STRING_ELT(sstems, i)));
+		}
+	}
+
+out:
+	if (fclose(stream) != 0 && !err) {
+		err = CORPUS_ERROR_OS;
+	}
+	if (err) {
+		error("failed writing to file '%s'", file);
+	}
+	return R_NilValue;
+}
+
+
+struct reader {
+	const uint8_t *ptr;
+	const uint8_t *end;
+};
+
+
+static int read_bytes(struct reader *r, void *dst, size_t size)
+{
+	if ((size_t)(r->end - r->ptr) < size) {
+		return CORPUS_ERROR_INVAL;
+	}
+	memcpy(dst, r->ptr, size);
+	r->ptr += size;
+	return 0;
+}
+
+
+static int read_string(struct reader *r, SEXP *strptr)
+{
+	int32_t size;
+	int err = 0;
+
+	TRY(read_bytes(r, &size, sizeof(size)));
+	if (size < 0) {
+		*strptr = NA_STRING;
+	} else if ((size_t)(r->end - r->ptr) < (size_t)size) {
+		err = CORPUS_ERROR_INVAL;
+	} else {
+		*strptr = mkCharLenCE((const char *)r->ptr, size, CE_UTF8);
+		r->ptr += size;
+	}
+out:
+	return err;
+}
+
+
+SEXP text_filter_read(SEXP sfile)
+{
+	SEXP ans, names, sbuf, sspec, stypes, sstems, str;
+	struct corpus_filebuf *buf;
+	struct reader r;
+	char magic[8];
+	uint64_t spec_size;
+	uint32_t version, bom, ntype, has_stems, i;
+	int nprot = 0, err = 0;
+
+	PROTECT(sbuf = alloc_filebuf(sfile)); nprot++;
+	buf = as_filebuf(sbuf);
+	r.ptr = buf->map_addr;
+	r.end = buf->map_addr + buf->map_size;
+
+	sstems = R_NilValue;
+
+	TRY(read_bytes(&r, magic, sizeof(magic)));
+	if (memcmp(magic, FILTER_FILE_MAGIC, sizeof(magic)) != 0) {
+		error("file is not a saved text filter");
+	}
+	TRY(read_bytes(&r, &version, sizeof(version)));
+	TRY(read_bytes(&r, &bom, sizeof(bom)));
+	if (bom != FILTER_FILE_BOM) {
+		error("saved text filter has a different byte order");
+	}
+	if (version != FILTER_FILE_VERSION) {
+		error("saved text filter has unsupported version (%u)",
+		      (unsigned)version);
+	}
+
+	TRY(read_bytes(&r, &spec_size, sizeof(spec_size)));
+	if ((uint64_t)(r.end - r.ptr) < spec_size) {
+		err = CORPUS_ERROR_INVAL;
+		goto out;
+	}
+	PROTECT(sspec = allocVector(RAWSXP, (R_xlen_t)spec_size)); nprot++;
+	TRY(read_bytes(&r, RAW(sspec), (size_t)spec_size));
+
+	TRY(read_bytes(&r, &ntype, sizeof(ntype)));
+	TRY(read_bytes(&r, &has_stems, sizeof(has_stems)));
+
+	PROTECT(stypes = allocVector(STRSXP, ntype)); nprot++;
+	if (has_stems) {
+		PROTECT(sstems = allocVector(STRSXP, ntype)); nprot++;
+	}
+
+	for (i = 0; i < ntype; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+		TRY(read_string(&r, &str));
+		SET_STRING_ELT(stypes, i, str);
+		if (has_stems) {
+			TRY(read_string(&r, &str));
+			SET_STRING_ELT(sstems, i, str);
+		}
+	}
+
+	PROTECT(ans = allocVector(VECSXP, 3)); nprot++;
+	SET_VECTOR_ELT(ans, 0, sspec);
+	SET_VECTOR_ELT(ans, 1, stypes);
+	SET_VECTOR_ELT(ans, 2, sstems);
+
+	PROTECT(names = allocVector(STRSXP, 3)); nprot++;
+	SET_STRING_ELT(names, 0, mkChar("spec"));
+	SET_STRING_ELT(names, 1, mkChar("types"));
+	SET_STRING_ELT(names, 2, mkChar("stems"));
+	setAttrib(ans, R_NamesSymbol, names);
+
+out:
+	if (err) {
+		error("saved text filter is truncated or corrupted");
+	}
+	UNPROTECT(nprot);
+	return ans;
+}
@@ -0,0 +1,349 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rcorpus.h"
+
+/*
+ * Hashing text values. We hash the decoded UTF-8 bytes of each text
+ * (optionally, after the filter's case and quote mapping), without
+ * creating a CHARSXP for it. Equal hashes get confirmed by comparing the
+ * bytes.
+ */
+
+#define HASH_NA UINT64_C(0x9E3779B97F4A7C15)
+
+// the bytes of a text value, decoded and possibly normalized
+struct key {
+	const uint8_t *ptr;
+	size_t size;
+	int is_na;
+};
+
+struct keybuf {
+	uint8_t *ptr;
+	size_t size_max;
+};
+
+struct context {
+	struct utf8lite_textmap map;
+	struct keybuf buf[2];
+	uint64_t *hash;
+	int *buckets;
+	int *items;
+	int nbucket;
+	int nitem;
+	int has_map;
+};
+
+
+static void context_destroy(void *obj)
+{
+	struct context *ctx = obj;
+
+	corpus_free(ctx->items);
+	corpus_free(ctx->buckets);
+	corpus_free(ctx->hash);
+	corpus_free(ctx->buf[1].ptr);
+	corpus_free(ctx->buf[0].ptr);
+	if (ctx->has_map) {
+		utf8lite_textmap_destroy(&ctx->map);
+	}
+}
+
+
+static void context_init(struct context *ctx, int normalize, int kind)
+{
+	int err = 0;
+
+	if (normalize) {
+		TRY(utf8lite_textmap_init(&ctx->map, kind));
+		ctx->has_map = 1;
+	}
+out:
+	CHECK_ERROR(err);
+}
+
+
+static int keybuf_reserve(struct keybuf *buf, size_t size)
+{
+	uint8_t *ptr;
+
+	if (size <= buf->size_max) {
+		return 0;
+	}
+	if (!(ptr = corpus_realloc(buf->ptr, size))) {
+		return CORPUS_ERROR_NOMEM;
+	}
+	buf->ptr = ptr;
+	buf->size_max = size;
+	return 0;
+}
+
+
+/*
+ * Get the bytes for a text value. The result is valid until the next
+ * call with the same slot.
+ */
+static int context_key(struct context *ctx, const struct utf8lite_text *text,
+		       int slot, struct key *key)
+{
+	struct utf8lite_text_iter it;
+	struct keybuf *buf = &ctx->buf[slot];
+	size_t size = UTF8LITE_TEXT_SIZE(text);
+	uint8_t *ptr;
+	int err = 0;
+
+	key->is_na = (text->ptr == NULL);
+	if (key->is_na) {
+		key->ptr = NULL;
+		key->size = 0;
+		return 0;
+	}
+
+	if (ctx->has_map) {
+		TRY(utf8lite_textmap_set(&ctx->map, text));
+		key->size = UTF8LITE_TEXT_SIZE(&ctx->map.text);
+		if (slot == 1) {
+			key->ptr = ctx->map.text.ptr;
+		} else {
+			// the next call overwrites the map; keep a copy
+			TRY(keybuf_reserve(buf, key->size));
+			if (key->size) {
+				memcpy(buf->ptr, ctx->map.text.ptr, key->size);
+			}
+			key->ptr = buf->ptr;
+		}
+	} else if (UTF8LITE_TEXT_HAS_ESC(text)) {
+		TRY(keybuf_reserve(buf, size));
+		utf8lite_text_iter_make(&it, text);
+		ptr = buf->ptr;
+		while (utf8lite_text_iter_advance(&it)) {
+			utf8lite_encode_utf8(it.current, &ptr);
+		}
+		key->ptr = buf->ptr;
+		key->size = (size_t)(ptr - buf->ptr);
+	} else {
+		key->ptr = text->ptr;
+		key->size = size;
+	}
+out:
+	return err;
+}
+
+
+static uint64_t mix64(uint64_t x)
+{
+	x ^= x >> 33;
+	x *= UINT64_C(0xFF51AFD7ED558CCD);
+	x ^= x >> 33;
+	x *= UINT64_C(0xC4CEB9FE1A85EC53);
+	x ^= x >> 33;
+	return x;
+}
+
+
+// hash eight bytes at a time
+static uint64_t key_hash(const struct key *key)
+{
+	const uint8_t *ptr = key->ptr;
+	size_t n = key->size;
+	uint64_t h, w;
+
+	if (key->is_na) {
+		return HASH_NA;
+	}
+
+	h = UINT64_C(0x27D4EB2F165667C5) ^ (uint64_t)n;
+	while (n >= 8) {
+		memcpy(&w, ptr, 8);
+		h = (h ^ mix64(w)) * UINT64_C(0x9FB21C651E98DF25);
+		ptr += 8;
+		n -= 8;
+	}
+	if (n > 0) {
+		w = 0;
+		memcpy(&w, ptr, n);
+		h = (h ^ mix64(w)) * UINT64_C(0x9FB21C651E98DF25);
+	}
+	return mix64(h);
+}
+
+
+static int key_equal(const struct key *k1, const struct key *k2)
+{
+	if (k1->is_na || k2->is_na) {
+		return k1->is_na && k2->is_na;
+	}
+	return (k1->size == k2->size
+		&& (k1->size == 0 || memcmp(k1->ptr, k2->ptr, k1->size) == 0));
+}
+
+
+static void context_table_init(struct context *ctx, R_xlen_t n)
+{
+	int b, err = 0;
+
+	// keep 2 * n, and so the bucket count, at most 2^30
+	if (n > INT_MAX / 4) {
+		error("text length exceeds maximum (%d)", INT_MAX / 4);
+	}
+
+	ctx->nbucket = 1;
+	while (ctx->nbucket < 2 * n) {
+		ctx->nbucket *= 2;
+	}
+
+	TRY_ALLOC(ctx->buckets = corpus_malloc((size_t)ctx->nbucket
+					       * sizeof(*ctx->buckets)));
+	TRY_ALLOC(ctx->items = corpus_malloc((n ? n : 1)
+					     * sizeof(*ctx->items)));
+	TRY_ALLOC(ctx->hash = corpus_malloc((n ? n : 1)
+					    * sizeof(*ctx->hash)));
+	for (b = 0; b < ctx->nbucket; b++) {
+		ctx->buckets[b] = -1;
+	}
+out:
+	CHECK_ERROR(err);
+}
+
+
+/*
+ * Find the item in the table with the same bytes as text, inserting id
+ * for text if there is none and insert is non-zero. Returns the id of
+ * the matching item, or -1 if there is none.
+ */
+static int context_find(struct context *ctx,
+			const struct utf8lite_text *items,
+			const struct utf8lite_text *text, int id, int insert)
+{
+	struct key key, other;
+	uint64_t hash;
+	int b, i, mask, err = 0;
+
+	TRY(context_key(ctx, text, 0, &key));
+	hash = key_hash(&key);
+	mask = ctx->nbucket - 1;
+	b = (int)(hash & mask);
+
+	while ((i = ctx->buckets[b]) >= 0) {
+		if (ctx->hash[i] == hash) {
+			TRY(context_key(ctx, &items[ctx->items[i]], 1,
+					&other));
+			if (key_equal(&key, &other)) {
+				return ctx->items[i];
+			}
+		}
+		b = (b + 1) & mask;
+	}
+
+	if (insert) {
+		i = ctx->nitem++;
+		ctx->items[i] = id;
+		ctx->hash[i] = hash;
+		ctx->buckets[b] = i;
+	}
+out:
+	CHECK_ERROR(err);
+	return -1;
+}
+
+
+static int as_normalize(SEXP snormalize)
+{
+	if (!(TYPEOF(snormalize) == LGLSXP && XLENGTH(snormalize) == 1)) {
+		error("invalid 'normalize' argument");
+	}
+	return (LOGICAL(snormalize)[0] == TRUE);
+}
+
+
+SEXP text_duplicated(SEXP sx, SEXP sfromlast, SEXP snormalize)
+{
+	SEXP ans, sctx;
+	struct context *ctx;
+	const struct utf8lite_text *text;
+	R_xlen_t i, k, n;
+	int *dup, fromlast, normalize, nprot = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	text = as_text(sx, &n);
+	fromlast = (LOGICAL(sfromlast)[0] == TRUE);
+	normalize = as_normalize(snormalize);
+
+	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy)); nprot++;
+	ctx = as_context(sctx);
+	context_init(ctx, normalize, normalize ? text_type_kind(sx) : 0);
+	context_table_init(ctx, n);
+
+	PROTECT(ans = allocVector(LGLSXP, n)); nprot++;
+	dup = LOGICAL(ans);
+
+	for (k = 0; k < n; k++) {
+		RCORPUS_CHECK_INTERRUPT(k);
+
+		i = fromlast ? n - 1 - k : k;
+		dup[i] = (context_find(ctx, text, &text[i], (int)i, 1) >= 0);
+	}
+
+	free_context(sctx);
+	UNPROTECT(nprot);
+	return ans;
+}
+
+
+SEXP text_lookup(SEXP sx, SEXP stable, SEXP snormalize)
+{
+	SEXP ans, sctx;
+	struct context *ctx;
+	const struct utf8lite_text *text, *table;
+	R_xlen_t i, n, ntable;
+	int *index, id, normalize, nprot = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	PROTECT(stable = coerce_text(stable)); nprot++;
+	text = as_text(sx, &n);
+	table = as_text(stable, &ntable);
+	normalize = as_normalize(snormalize);
+
+	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy)); nprot++;
+	ctx = as_context(sctx);
+	context_init(ctx, normalize, normalize ? text_type_kind(sx) : 0);
+	context_table_init(ctx, ntable);
+
+	// index the table; the first match wins
+	for (i = 0; i < ntable; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+		context_find(ctx, table, &table[i], (int)i, 1);
+	}
+
+	PROTECT(ans = allocVector(INTSXP, n)); nprot++;
+	index = INTEGER(ans);
+
+	for (i = 0; i < n; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+		id = context_find(ctx, table, &text[i], -1, 0);
+		index[i] = (id < 0) ? NA_INTEGER : id + 1;
+	}
+
+	free_context(sctx);
+	UNPROTECT(nprot);
+	return ans;
+}
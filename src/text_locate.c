@@ -15,6 +15,7 @@
  */
 
 #include <stddef.h>
+#include <stdio.h>
 #include "rcorpus.h"
 
 
@@ -92,12 +93,23 @@ out:
 }
 
 
+// whether the text's filter has a stemmer, which rules out the prefilter
+static int text_stemmed(SEXP sx)
+{
+	SEXP filter = getListElement(sx, "filter");
+
+	return (filter != R_NilValue
+		&& getListElement(filter, "stemmer") != R_NilValue);
+}
+
+
 SEXP text_count(SEXP sx, SEXP sterms)
 {
 	SEXP ans, ssearch;
 	const struct utf8lite_text *text;
 	struct corpus_filter *filter;
 	struct corpus_search *search;
+	struct prefilter pf;
 	R_xlen_t i, n;
 	int count;
 	int err, nprot;
@@ -110,10 +122,12 @@ SEXP text_count(SEXP sx, SEXP sterms)
 
 	PROTECT(ssearch = alloc_search(sterms, "count", filter)); nprot++;
 	search = as_search(ssearch);
+	prefilter_init(&pf, search, filter, text_stemmed(sx));
 
 	PROTECT(ans = allocVector(REALSXP, n)); nprot++;
 	setAttrib(ans, R_NamesSymbol, names_text(sx));
 
+	TRACE_BEGIN("text_count:scan");
 	for (i = 0; i < n; i++) {
 		RCORPUS_CHECK_INTERRUPT(i);
 
@@ -122,6 +136,11 @@ SEXP text_count(SEXP sx, SEXP sterms)
 			continue;
 		}
 
+		if (!prefilter_pass(&pf, &text[i])) {
+			REAL(ans)[i] = 0;
+			continue;
+		}
+
 		TRY(corpus_search_start(search, &text[i], filter));
 
 		count = 0;
@@ -132,6 +151,7 @@ SEXP text_count(SEXP sx, SEXP sterms)
 
 		TRY(search->error);
 	}
+	TRACE_END("text_count:scan");
 
 	err = 0;
 out:
@@ -147,6 +167,7 @@ SEXP text_detect(SEXP sx, SEXP sterms)
 	const struct utf8lite_text *text;
 	struct corpus_filter *filter;
 	struct corpus_search *search;
+	struct prefilter pf;
 	R_xlen_t i, n;
 	int err, nprot;
 
@@ -158,10 +179,12 @@ SEXP text_detect(SEXP sx, SEXP sterms)
 
 	PROTECT(ssearch = alloc_search(sterms, "detect", filter)); nprot++;
 	search = as_search(ssearch);
+	prefilter_init(&pf, search, filter, text_stemmed(sx));
 
 	PROTECT(ans = allocVector(LGLSXP, n)); nprot++;
 	setAttrib(ans, R_NamesSymbol, names_text(sx));
 
+	TRACE_BEGIN("text_detect:scan");
 	for (i = 0; i < n; i++) {
 		RCORPUS_CHECK_INTERRUPT(i);
 
@@ -170,6 +193,11 @@ SEXP text_detect(SEXP sx, SEXP sterms)
 			continue;
 		}
 
+		if (!prefilter_pass(&pf, &text[i])) {
+			LOGICAL(ans)[i] = FALSE;
+			continue;
+		}
+
 		TRY(corpus_search_start(search, &text[i], filter));
 
 		if (corpus_search_advance(search)) {
@@ -180,6 +208,7 @@ SEXP text_detect(SEXP sx, SEXP sterms)
 
 		TRY(search->error);
 	}
+	TRACE_END("text_detect:scan");
 
 	err = 0;
 out:
@@ -211,6 +240,7 @@ SEXP text_match(SEXP sx, SEXP sterms)
 
 	locate_init(&loc);
 
+	TRACE_BEGIN("text_match:scan");
 	for (i = 0; i < n; i++) {
 		RCORPUS_CHECK_INTERRUPT(i);
 
@@ -228,8 +258,12 @@ SEXP text_match(SEXP sx, SEXP sterms)
 
 		TRY(search->error);
 	}
+	TRACE_END("text_match:scan");
 
+	TRACE_BEGIN("text_match:output");
 	PROTECT(ans = make_matches(&loc, sitems)); nprot++;
+	TRACE_END("text_match:output");
+
 	err = 0;
 out:
 	CHECK_ERROR(err);
@@ -259,6 +293,7 @@ SEXP text_locate(SEXP sx, SEXP sterms)
 
 	locate_init(&loc);
 
+	TRACE_BEGIN("text_locate:scan");
 	for (i = 0; i < n; i++) {
 		RCORPUS_CHECK_INTERRUPT(i);
 
@@ -276,8 +311,12 @@ SEXP text_locate(SEXP sx, SEXP sterms)
 
 		TRY(search->error);
 	}
+	TRACE_END("text_locate:scan");
 
+	TRACE_BEGIN("text_locate:output");
 	PROTECT(ans = make_instances(&loc, sx, text)); nprot++;
+	TRACE_END("text_locate:output");
+
 	err = 0;
 out:
 	UNPROTECT(nprot);
@@ -447,3 +486,147 @@ SEXP make_instances(struct locate *loc, SEXP sx,
 	UNPROTECT(nprot);
 	return ans;
 }
+
+
+/*
+ * Detecting in an NDJSON file streams the rows through the pipeline and
+ * searches the field of each, without building a text object; we only
+ * keep the numbers of the matching rows.
+ */
+
+struct detect_ndjson {
+	struct ndjson_pipeline *pipeline;
+	double *rows;
+	R_xlen_t nrow;
+	R_xlen_t nrow_max;
+};
+
+
+static void detect_ndjson_destroy(void *obj)
+{
+	struct detect_ndjson *ctx = obj;
+
+	ndjson_pipeline_close(ctx->pipeline);
+	ctx->pipeline = NULL;
+	corpus_free(ctx->rows);
+	ctx->rows = NULL;
+}
+
+
+static void detect_ndjson_fail(struct detect_ndjson *ctx)
+{
+	char message[256];
+
+	snprintf(message, sizeof(message), "%s", ctx->pipeline
+		 ? ndjson_pipeline_message(ctx->pipeline)
+		 : "failed allocating memory");
+	detect_ndjson_destroy(ctx);
+	error("%s", message);
+}
+
+
+static int detect_ndjson_add(struct detect_ndjson *ctx, R_xlen_t row)
+{
+	double *rows;
+	R_xlen_t max;
+	int err = 0;
+
+	if (ctx->nrow == ctx->nrow_max) {
+		max = ctx->nrow_max ? 2 * ctx->nrow_max : 256;
+		TRY_ALLOC(rows = corpus_realloc(ctx->rows,
+						(size_t)max * sizeof(*rows)));
+		ctx->rows = rows;
+		ctx->nrow_max = max;
+	}
+	ctx->rows[ctx->nrow++] = (double)(row + 1);
+out:
+	return err;
+}
+
+
+SEXP text_detect_ndjson(SEXP sfile, SEXP sfield, SEXP sx, SEXP sterms,
+			SEXP sthreads)
+{
+	SEXP ans = R_NilValue, sctx, ssearch;
+	struct detect_ndjson *ctx;
+	const struct ndjson_batch *batch;
+	const struct utf8lite_text *text;
+	struct corpus_filter *filter;
+	struct corpus_search *search;
+	struct prefilter pf;
+	const char *path, *field;
+	R_xlen_t i, nbatch = 0;
+	int nthread, err = 0, nprot = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	as_text(sx, NULL); // load the handle before building the filter
+	filter = text_filter(sx);
+
+	path = R_ExpandFileName(translateChar(STRING_ELT(sfile, 0)));
+	field = translateCharUTF8(STRING_ELT(sfield, 0));
+
+	if (sthreads == R_NilValue) {
+		nthread = default_threads();
+	} else {
+		nthread = INTEGER(sthreads)[0];
+		if (nthread == NA_INTEGER || nthread < 1) {
+			error("invalid 'threads' argument");
+		}
+	}
+
+	PROTECT(ssearch = alloc_search(sterms, "detect", filter)); nprot++;
+	search = as_search(ssearch);
+	prefilter_init(&pf, search, filter, text_stemmed(sx));
+
+	PROTECT(sctx = alloc_context(sizeof(*ctx), detect_ndjson_destroy));
+	nprot++;
+	ctx = as_context(sctx);
+
+	if (ndjson_pipeline_open(&ctx->pipeline, path, field, nthread,
+				 2 * nthread + 2)) {
+		detect_ndjson_fail(ctx);
+	}
+
+	TRACE_BEGIN("text_detect_ndjson:scan");
+	for (;;) {
+		RCORPUS_CHECK_INTERRUPT(nbatch);
+		nbatch++;
+
+		if (ndjson_pipeline_next(ctx->pipeline, &batch)) {
+			TRACE_END("text_detect_ndjson:scan");
+			detect_ndjson_fail(ctx);
+		}
+		if (!batch) {
+			break;
+		}
+
+		for (i = 0; i < batch->ntext; i++) {
+			text = &batch->text[i];
+			if (!text->ptr || !prefilter_pass(&pf, text)) {
+				continue;
+			}
+
+			TRY(corpus_search_start(search, text, filter));
+			if (corpus_search_advance(search)) {
+				TRY(detect_ndjson_add(ctx,
+						      batch->first_row + i));
+			}
+			TRY(search->error);
+		}
+	}
+	TRACE_END("text_detect_ndjson:scan");
+
+	PROTECT(ans = allocVector(REALSXP, ctx->nrow)); nprot++;
+	for (i = 0; i < ctx->nrow; i++) {
+		REAL(ans)[i] = ctx->rows[i];
+	}
+
+out:
+	if (err) {
+		detect_ndjson_destroy(ctx);
+	}
+	CHECK_ERROR(err);
+	free_context(sctx);
+	UNPROTECT(nprot);
+	return ans;
+}
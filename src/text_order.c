@@ -0,0 +1,448 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rcorpus.h"
+
+/*
+ * Ordering text values by their UTF-8 bytes, which is the same as
+ * ordering by code point. We sort the indices with an MSD radix sort,
+ * switching to insertion sort for small ranges. For sort(), we return
+ * the permutation itself; for xtfrm(), we convert it to ranks.
+ */
+
+#define SMALL_SORT 32
+
+struct key {
+	const uint8_t *ptr;
+	size_t size;
+};
+
+struct range {
+	R_xlen_t begin;
+	R_xlen_t end;
+	size_t depth;
+};
+
+struct context {
+	struct utf8lite_textmap map;
+	struct key *keys;
+	size_t *offset;
+	uint8_t *arena;
+	size_t arena_size;
+	size_t arena_max;
+	int *perm;
+	int *work;
+	struct range *stack;
+	size_t nstack_max;
+	int has_map;
+};
+
+
+static void context_destroy(void *obj)
+{
+	struct context *ctx = obj;
+
+	corpus_free(ctx->stack);
+	corpus_free(ctx->work);
+	corpus_free(ctx->perm);
+	corpus_free(ctx->arena);
+	corpus_free(ctx->offset);
+	corpus_free(ctx->keys);
+	if (ctx->has_map) {
+		utf8lite_textmap_destroy(&ctx->map);
+	}
+}
+
+
+static int arena_append(struct context *ctx, const uint8_t *ptr, size_t size)
+{
+	uint8_t *arena;
+	size_t max = ctx->arena_max ? ctx->arena_max : 4096;
+
+	while (max - ctx->arena_size < size) {
+		if (max > SIZE_MAX / 2) {
+			return CORPUS_ERROR_OVERFLOW;
+		}
+		max *= 2;
+	}
+
+	if (max != ctx->arena_max) {
+		if (!(arena = corpus_realloc(ctx->arena, max))) {
+			return CORPUS_ERROR_NOMEM;
+		}
+		ctx->arena = arena;
+		ctx->arena_max = max;
+	}
+
+	if (size) {
+		memcpy(ctx->arena + ctx->arena_size, ptr, size);
+	}
+	ctx->arena_size += size;
+	return 0;
+}
+
+
+/*
+ * Get the sort key for each non-missing text. Keys point directly into
+ * the text unless the text has escapes or we need to case-fold it, in
+ * which case they point into the arena.
+ */
+static void context_keys(struct context *ctx, const struct utf8lite_text *text,
+			 R_xlen_t n, int map_case)
+{
+	struct utf8lite_text_iter it;
+	uint8_t buf[4], *end;
+	R_xlen_t i;
+	int err = 0;
+
+	if (map_case) {
+		TRY(utf8lite_textmap_init(&ctx->map, UTF8LITE_TEXTMAP_CASE));
+		ctx->has_map = 1;
+	}
+
+	TRY_ALLOC(ctx->keys = corpus_calloc(n ? n : 1, sizeof(*ctx->keys)));
+	TRY_ALLOC(ctx->offset = corpus_calloc(n ? n : 1,
+					      sizeof(*ctx->offset)));
+
+	for (i = 0; i < n; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+
+		if (!text[i].ptr) {
+			continue;
+		}
+
+		if (map_case) {
+			TRY(utf8lite_textmap_set(&ctx->map, &text[i]));
+			ctx->offset[i] = ctx->arena_size;
+			ctx->keys[i].size = UTF8LITE_TEXT_SIZE(&ctx->map.text);
+			TRY(arena_append(ctx, ctx->map.text.ptr,
+					 ctx->keys[i].size));
+		} else if (UTF8LITE_TEXT_HAS_ESC(&text[i])) {
+			ctx->offset[i] = ctx->arena_size;
+			utf8lite_text_iter_make(&it, &text[i]);
+			while (utf8lite_text_iter_advance(&it)) {
+				end = buf;
+				utf8lite_encode_utf8(it.current, &end);
+				TRY(arena_append(ctx, buf, (size_t)(end - buf)));
+			}
+			ctx->keys[i].size = ctx->arena_size - ctx->offset[i];
+		} else {
+			ctx->keys[i].ptr = text[i].ptr;
+			ctx->keys[i].size = UTF8LITE_TEXT_SIZE(&text[i]);
+		}
+	}
+
+	// the arena is final; point the keys into it
+	for (i = 0; i < n; i++) {
+		if (text[i].ptr && !ctx->keys[i].ptr) {
+			ctx->keys[i].ptr = ctx->arena + ctx->offset[i];
+		}
+	}
+out:
+	CHECK_ERROR(err);
+}
+
+
+// compare two keys, starting at byte 'depth'
+static int key_cmp(const struct key *k1, const struct key *k2, size_t depth)
+{
+	size_t n1 = k1->size - depth, n2 = k2->size - depth;
+	size_t n = n1 < n2 ? n1 : n2;
+	int cmp;
+
+	if (n > 0 && (cmp = memcmp(k1->ptr + depth, k2->ptr + depth, n))) {
+		return cmp;
+	}
+	return (n1 > n2) - (n1 < n2);
+}
+
+
+static void insertion_sort(struct context *ctx, int *perm, R_xlen_t n,
+			   size_t depth)
+{
+	R_xlen_t i, j;
+	int id;
+
+	for (i = 1; i < n; i++) {
+		id = perm[i];
+		j = i;
+		while (j > 0 && key_cmp(&ctx->keys[perm[j - 1]],
+					&ctx->keys[id], depth) > 0) {
+			perm[j] = perm[j - 1];
+			j--;
+		}
+		perm[j] = id;
+	}
+}
+
+
+static int push_range(struct context *ctx, size_t *nstack, R_xlen_t begin,
+		      R_xlen_t end, size_t depth)
+{
+	struct range *stack;
+	size_t max;
+
+	if (*nstack == ctx->nstack_max) {
+		max = ctx->nstack_max ? 2 * ctx->nstack_max : 256;
+		if (!(stack = corpus_realloc(ctx->stack,
+					     max * sizeof(*stack)))) {
+			return CORPUS_ERROR_NOMEM;
+		}
+		ctx->stack = stack;
+		ctx->nstack_max = max;
+	}
+
+	ctx->stack[*nstack].begin = begin;
+	ctx->stack[*nstack].end = end;
+	ctx->stack[*nstack].depth = depth;
+	(*nstack)++;
+	return 0;
+}
+
+
+/*
+ * Stable MSD radix sort of perm[0..n) by key. Bucket 0 holds the keys
+ * that end at the current depth; byte b goes to bucket b + 1.
+ */
+static void radix_sort(struct context *ctx, R_xlen_t n)
+{
+	R_xlen_t count[257], pos[257];
+	struct range r;
+	const struct key *key;
+	R_xlen_t i, len;
+	size_t nstack = 0, niter = 0;
+	int b, err = 0;
+
+	if (n < 2) {
+		return;
+	}
+
+	TRY(push_range(ctx, &nstack, 0, n, 0));
+
+	while (nstack > 0) {
+		RCORPUS_CHECK_INTERRUPT(niter);
+		niter++;
+
+		r = ctx->stack[--nstack];
+		len = r.end - r.begin;
+
+		if (len <= SMALL_SORT) {
+			insertion_sort(ctx, ctx->perm + r.begin, len, r.depth);
+			continue;
+		}
+
+		memset(count, 0, sizeof(count));
+		for (i = r.begin; i < r.end; i++) {
+			key = &ctx->keys[ctx->perm[i]];
+			b = (r.depth < key->size) ? key->ptr[r.depth] + 1 : 0;
+			count[b]++;
+		}
+
+		// all keys share this byte; go deeper without moving them
+		if (count[0] == 0) {
+			for (b = 1; b < 257; b++) {
+				if (count[b] == len) {
+					break;
+				}
+			}
+			if (b < 257) {
+				TRY(push_range(ctx, &nstack, r.begin, r.end,
+					       r.depth + 1));
+				continue;
+			}
+		}
+
+		pos[0] = r.begin;
+		for (b = 1; b < 257; b++) {
+			pos[b] = pos[b - 1] + count[b - 1];
+		}
+
+		for (i = r.begin; i < r.end; i++) {
+			key = &ctx->keys[ctx->perm[i]];
+			b = (r.depth < key->size) ? key->ptr[r.depth] + 1 : 0;
+			ctx->work[pos[b]++] = ctx->perm[i];
+		}
+		memcpy(ctx->perm + r.begin, ctx->work + r.begin,
+		       len * sizeof(*ctx->perm));
+
+		// bucket 0 is done: those keys are all equal
+		i = r.begin + count[0];
+		for (b = 1; b < 257; b++) {
+			if (count[b] > 1) {
+				TRY(push_range(ctx, &nstack, i, i + count[b],
+					       r.depth + 1));
+			}
+			i += count[b];
+		}
+	}
+out:
+	CHECK_ERROR(err);
+}
+
+
+// sort the indices of the non-missing texts into ctx->perm; return
+// their number
+static R_xlen_t context_sort(struct context *ctx,
+			     const struct utf8lite_text *text, R_xlen_t n,
+			     int map_case)
+{
+	R_xlen_t i, m = 0;
+	int err = 0;
+
+	if (n > INT_MAX) {
+		error("text length exceeds maximum (%d)", INT_MAX);
+	}
+
+	context_keys(ctx, text, n, map_case);
+
+	TRY_ALLOC(ctx->perm = corpus_malloc((n ? n : 1) * sizeof(*ctx->perm)));
+	TRY_ALLOC(ctx->work = corpus_malloc((n ? n : 1) * sizeof(*ctx->work)));
+	for (i = 0; i < n; i++) {
+		if (text[i].ptr) {
+			ctx->perm[m++] = (int)i;
+		}
+	}
+	radix_sort(ctx, m);
+out:
+	CHECK_ERROR(err);
+	return m;
+}
+
+
+SEXP text_xtfrm(SEXP sx, SEXP smap_case)
+{
+	SEXP ans = R_NilValue, sctx;
+	struct context *ctx;
+	const struct utf8lite_text *text;
+	const struct key *prev, *key;
+	R_xlen_t i, n, m;
+	int *rank, map_case, r, nprot = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	text = as_text(sx, &n);
+	map_case = (LOGICAL(smap_case)[0] == TRUE);
+
+	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy)); nprot++;
+	ctx = as_context(sctx);
+	m = context_sort(ctx, text, n, map_case);
+
+	PROTECT(ans = allocVector(INTSXP, n)); nprot++;
+	rank = INTEGER(ans);
+	for (i = 0; i < n; i++) {
+		if (!text[i].ptr) {
+			rank[i] = NA_INTEGER;
+		}
+	}
+
+	// dense ranks; equal keys get equal ranks
+	r = 0;
+	prev = NULL;
+	for (i = 0; i < m; i++) {
+		key = &ctx->keys[ctx->perm[i]];
+		if (!prev || key_cmp(prev, key, 0) != 0) {
+			r++;
+		}
+		rank[ctx->perm[i]] = r;
+		prev = key;
+	}
+
+	free_context(sctx);
+	UNPROTECT(nprot);
+	return ans;
+}
+
+
+/*
+ * The permutation that sorts the texts, as order() would give for the
+ * ranks: 1-based, stable, with the missing values dropped (NA), last
+ * (TRUE), or first (FALSE). Decreasing order reverses the runs of equal
+ * keys, but keeps each run in its original order.
+ */
+SEXP text_order(SEXP sx, SEXP smap_case, SEXP sdecreasing, SEXP sna_last)
+{
+	SEXP ans = R_NilValue, sctx;
+	struct context *ctx;
+	const struct utf8lite_text *text;
+	R_xlen_t i, j, n, m, nmiss, off, begin, end;
+	int *perm, map_case, decreasing, na_last, nprot = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	text = as_text(sx, &n);
+	map_case = (LOGICAL(smap_case)[0] == TRUE);
+	decreasing = (LOGICAL(sdecreasing)[0] == TRUE);
+	na_last = LOGICAL(sna_last)[0];
+
+	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy)); nprot++;
+	ctx = as_context(sctx);
+	m = context_sort(ctx, text, n, map_case);
+	nmiss = n - m;
+
+	PROTECT(ans = allocVector(INTSXP, na_last == NA_LOGICAL ? m : n));
+	nprot++;
+	perm = INTEGER(ans);
+
+	off = 0;
+	if (na_last == FALSE) {
+		for (i = 0; i < n; i++) {
+			if (!text[i].ptr) {
+				perm[off++] = (int)(i + 1);
+			}
+		}
+	}
+
+	if (!decreasing) {
+		for (i = 0; i < m; i++) {
+			perm[off + i] = ctx->perm[i] + 1;
+		}
+	} else {
+		// copy the runs of equal keys from last to first
+		end = m;
+		while (end > 0) {
+			RCORPUS_CHECK_INTERRUPT(end);
+
+			begin = end - 1;
+			while (begin > 0
+			       && key_cmp(&ctx->keys[ctx->perm[begin - 1]],
+					  &ctx->keys[ctx->perm[end - 1]],
+					  0) == 0) {
+				begin--;
+			}
+			for (j = begin; j < end; j++) {
+				perm[off + (m - end) + (j - begin)]
+					= ctx->perm[j] + 1;
+			}
+			end = begin;
+		}
+	}
+	off += m;
+
+	if (na_last == TRUE && nmiss > 0) {
+		for (i = 0; i < n; i++) {
+			if (!text[i].ptr) {
+				perm[off++] = (int)(i + 1);
+			}
+		}
+	}
+
+	free_context(sctx);
+	UNPROTECT(nprot);
+	return ans;
+}
@@ -0,0 +1,172 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "rcorpus.h"
+
+/*
+ * Packing a text object copies the bytes of the texts it refers to into
+ * raw vectors, and returns a new text object with those raw vectors as its
+ * only sources. The result no longer refers to the original sources
+ * (character vectors, JSON buffers, or memory-mapped files), so it can be
+ * serialized without them, and they can be garbage collected.
+ *
+ * Texts with JSON escapes get decoded. The table columns hold byte
+ * offsets as integers, so we start a new raw vector whenever the current
+ * one would grow beyond PACK_MAX bytes.
+ */
+
+// leave room for the 1-based start offset of an empty text at the end
+#define PACK_MAX (INT_MAX - 1)
+
+
+static size_t decoded_size(const struct utf8lite_text *text)
+{
+	struct utf8lite_text_iter it;
+	uint8_t buf[4], *end;
+	size_t size = 0;
+
+	if (!UTF8LITE_TEXT_HAS_ESC(text)) {
+		return UTF8LITE_TEXT_SIZE(text);
+	}
+
+	utf8lite_text_iter_make(&it, text);
+	while (utf8lite_text_iter_advance(&it)) {
+		end = buf;
+		utf8lite_encode_utf8(it.current, &end);
+		size += (size_t)(end - buf);
+	}
+	return size;
+}
+
+
+static void decode_into(const struct utf8lite_text *text, uint8_t *dst)
+{
+	struct utf8lite_text_iter it;
+
+	if (!UTF8LITE_TEXT_HAS_ESC(text)) {
+		memcpy(dst, text->ptr, UTF8LITE_TEXT_SIZE(text));
+		return;
+	}
+
+	utf8lite_text_iter_make(&it, text);
+	while (utf8lite_text_iter_advance(&it)) {
+		utf8lite_encode_utf8(it.current, &dst);
+	}
+}
+
+
+SEXP text_pack(SEXP sx)
+{
+	SEXP ans, sources, source, row, start, stop, chunk;
+	const struct utf8lite_text *text;
+	size_t *sizes, off, size;
+	R_xlen_t i, n;
+	int c, nchunk, nprot = 0;
+	uint8_t *dst;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	text = as_text(sx, &n);
+
+	// first pass: the decoded sizes, and the raw vector sizes
+	sizes = (void *)R_alloc(n ? n : 1, sizeof(*sizes));
+	nchunk = 1;
+	off = 0;
+	for (i = 0; i < n; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+
+		if (!text[i].ptr) {
+			continue;
+		}
+
+		size = decoded_size(&text[i]);
+		if (size > PACK_MAX) {
+			error("text size (%"PRIu64" bytes) exceeds maximum (%d)",
+			      (uint64_t)size, PACK_MAX);
+		}
+		if (off + size > PACK_MAX) {
+			nchunk++;
+			off = 0;
+		}
+		sizes[i] = size;
+		off += size;
+	}
+
+	PROTECT(sources = allocVector(VECSXP, nchunk)); nprot++;
+	PROTECT(source = allocVector(INTSXP, n)); nprot++;
+	PROTECT(row = allocVector(REALSXP, n)); nprot++;
+	PROTECT(start = allocVector(INTSXP, n)); nprot++;
+	PROTECT(stop = allocVector(INTSXP, n)); nprot++;
+
+	// allocate the raw vectors, repeating the chunking from above
+	c = 0;
+	off = 0;
+	for (i = 0; i <= n; i++) {
+		if (i < n && !text[i].ptr) {
+			continue;
+		}
+		if (i == n || off + sizes[i] > PACK_MAX) {
+			SET_VECTOR_ELT(sources, c, allocVector(RAWSXP, off));
+			c++;
+			off = 0;
+		}
+		if (i < n) {
+			off += sizes[i];
+		}
+	}
+
+	// second pass: copy the bytes and fill in the table
+	c = 0;
+	off = 0;
+	chunk = VECTOR_ELT(sources, 0);
+	for (i = 0; i < n; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+
+		REAL(row)[i] = 1;
+
+		if (!text[i].ptr) {
+			INTEGER(source)[i] = 1;
+			INTEGER(start)[i] = NA_INTEGER;
+			INTEGER(stop)[i] = NA_INTEGER;
+			continue;
+		}
+
+		if (off + sizes[i] > PACK_MAX) {
+			c++;
+			off = 0;
+			chunk = VECTOR_ELT(sources, c);
+		}
+
+		dst = RAW(chunk) + off;
+		decode_into(&text[i], dst);
+
+		INTEGER(source)[i] = c + 1;
+		INTEGER(start)[i] = (int)off + 1;
+		INTEGER(stop)[i] = (int)(off + sizes[i]);
+		off += sizes[i];
+	}
+
+	PROTECT(ans = alloc_text(sources, source, row, start, stop,
+				 getListElement(sx, "names"),
+				 getListElement(sx, "filter"))); nprot++;
+
+	UNPROTECT(nprot);
+	return ans;
+}
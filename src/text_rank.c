@@ -0,0 +1,724 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <inttypes.h>
+#include <limits.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rcorpus.h"
+
+/*
+ * Ranked retrieval. An index holds, for each type that appears in the
+ * texts, its postings: the (1-based) ids of the texts containing it, in
+ * increasing order, and the term frequencies. It also holds the text
+ * lengths and the norms of the TF-IDF vectors, and for each term, bounds
+ * on its score contribution: the maximum term frequency and minimum text
+ * length over its postings (for BM25, whatever the parameters), and the
+ * maximum normalized TF-IDF weight.
+ *
+ * Scoring goes term at a time, with the query terms in decreasing order of
+ * their bounds, accumulating into one score per text. Once the k-th best
+ * score so far exceeds the sum of the bounds of the remaining terms, no
+ * new text can make the top k: from then on, we only update the texts we
+ * already have, dropping those that can no longer catch up, and when
+ * those are few, we look them up in the postings instead of scanning.
+ */
+
+#define METHOD_BM25 0
+#define METHOD_TFIDF 1
+
+
+/* index construction */
+
+struct posting {
+	int type_id;
+	int doc;
+	int tf;
+};
+
+struct index_context {
+	int *last;
+	int *tf;
+	int ntype_max;
+	int *doc_types;
+	int ndoc_type;
+	struct posting *items;
+	size_t nitem;
+	size_t nitem_max;
+};
+
+
+static void index_context_destroy(void *obj)
+{
+	struct index_context *ctx = obj;
+
+	corpus_free(ctx->items);
+	corpus_free(ctx->doc_types);
+	corpus_free(ctx->tf);
+	corpus_free(ctx->last);
+}
+
+
+static int index_reserve_types(struct index_context *ctx, int ntype)
+{
+	int *last, *tf, *doc_types, max, i;
+
+	if (ntype <= ctx->ntype_max) {
+		return 0;
+	}
+
+	max = ctx->ntype_max ? ctx->ntype_max : 256;
+	while (max < ntype) {
+		max = (max > INT_MAX / 2) ? INT_MAX : 2 * max;
+	}
+
+	if (!(last = corpus_realloc(ctx->last, (size_t)max * sizeof(*last)))) {
+		return CORPUS_ERROR_NOMEM;
+	}
+	ctx->last = last;
+	if (!(tf = corpus_realloc(ctx->tf, (size_t)max * sizeof(*tf)))) {
+		return CORPUS_ERROR_NOMEM;
+	}
+	ctx->tf = tf;
+	doc_types = corpus_realloc(ctx->doc_types,
+				   (size_t)max * sizeof(*doc_types));
+	if (!doc_types) {
+		return CORPUS_ERROR_NOMEM;
+	}
+	ctx->doc_types = doc_types;
+
+	for (i = ctx->ntype_max; i < max; i++) {
+		ctx->last[i] = -1;
+		ctx->tf[i] = 0;
+	}
+	ctx->ntype_max = max;
+	return 0;
+}
+
+
+static int index_add(struct index_context *ctx, int type_id, int doc, int tf)
+{
+	struct posting *items;
+	size_t max;
+
+	if (ctx->nitem == ctx->nitem_max) {
+		max = ctx->nitem_max ? 2 * ctx->nitem_max : 4096;
+		items = corpus_realloc(ctx->items, max * sizeof(*items));
+		if (!items) {
+			return CORPUS_ERROR_NOMEM;
+		}
+		ctx->items = items;
+		ctx->nitem_max = max;
+	}
+
+	ctx->items[ctx->nitem].type_id = type_id;
+	ctx->items[ctx->nitem].doc = doc;
+	ctx->items[ctx->nitem].tf = tf;
+	ctx->nitem++;
+	return 0;
+}
+
+
+SEXP text_index(SEXP sx)
+{
+	SEXP ans = R_NilValue, sctx, snames, sterms, sptr, sdoc, stf, smax_tf,
+	     smin_len, smax_tfidf, slength, snorm;
+	const struct utf8lite_text *text;
+	const struct posting *item;
+	struct index_context *ctx;
+	struct corpus_filter *filter;
+	struct mkchar mkchar;
+	double *length, *norm, *idf, *ptr, w, ndoc_obs;
+	size_t j, *pos;
+	R_xlen_t i, n;
+	int *term_id, *df, type_id, t, nterm, ntype, len, k, err = 0, nprot = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	text = as_text(sx, &n);
+	filter = text_filter(sx);
+
+	if (n > INT_MAX) {
+		error("number of texts exceeds maximum (%d)", INT_MAX);
+	}
+
+	PROTECT(sctx = alloc_context(sizeof(*ctx), index_context_destroy));
+	nprot++;
+	ctx = as_context(sctx);
+
+	PROTECT(slength = allocVector(REALSXP, n)); nprot++;
+	length = REAL(slength);
+	ndoc_obs = 0;
+
+	TRACE_BEGIN("text_index:scan");
+	for (i = 0; i < n; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+
+		if (!text[i].ptr) {
+			length[i] = NA_REAL;
+			continue;
+		}
+		ndoc_obs++;
+
+		len = 0;
+		ctx->ndoc_type = 0;
+		TRY(corpus_filter_start(filter, &text[i]));
+		while (corpus_filter_advance(filter)) {
+			type_id = filter->type_id;
+			if (type_id < 0) {
+				continue;
+			}
+			TRY(index_reserve_types(ctx, type_id + 1));
+
+			if (ctx->last[type_id] != (int)i) {
+				ctx->last[type_id] = (int)i;
+				ctx->tf[type_id] = 0;
+				ctx->doc_types[ctx->ndoc_type++] = type_id;
+			}
+			ctx->tf[type_id]++;
+			len++;
+		}
+		TRY(filter->error);
+
+		for (k = 0; k < ctx->ndoc_type; k++) {
+			type_id = ctx->doc_types[k];
+			TRY(index_add(ctx, type_id, (int)i, ctx->tf[type_id]));
+		}
+		length[i] = (double)len;
+	}
+	TRACE_END("text_index:scan");
+
+	TRACE_BEGIN("text_index:postings");
+
+	// number the types that appear, in type id order
+	ntype = ctx->ntype_max;
+	df = (void *)R_alloc(ntype ? ntype : 1, sizeof(*df));
+	term_id = (void *)R_alloc(ntype ? ntype : 1, sizeof(*term_id));
+	memset(df, 0, (size_t)ntype * sizeof(*df));
+	for (j = 0; j < ctx->nitem; j++) {
+		df[ctx->items[j].type_id]++;
+	}
+
+	nterm = 0;
+	for (t = 0; t < ntype; t++) {
+		term_id[t] = df[t] ? nterm++ : -1;
+	}
+
+	if (ctx->nitem > R_XLEN_T_MAX) {
+		error("number of postings exceeds maximum (%"PRIu64")",
+		      (uint64_t)R_XLEN_T_MAX);
+	}
+
+	PROTECT(sterms = allocVector(STRSXP, nterm)); nprot++;
+	PROTECT(sptr = allocVector(REALSXP, nterm + 1)); nprot++;
+	PROTECT(sdoc = allocVector(INTSXP, (R_xlen_t)ctx->nitem)); nprot++;
+	PROTECT(stf = allocVector(INTSXP, (R_xlen_t)ctx->nitem)); nprot++;
+	PROTECT(smax_tf = allocVector(INTSXP, nterm)); nprot++;
+	PROTECT(smin_len = allocVector(REALSXP, nterm)); nprot++;
+	PROTECT(smax_tfidf = allocVector(REALSXP, nterm)); nprot++;
+	PROTECT(snorm = allocVector(REALSXP, n)); nprot++;
+
+	// offsets of the postings lists
+	ptr = REAL(sptr);
+	pos = (void *)R_alloc(nterm ? nterm : 1, sizeof(*pos));
+	idf = (void *)R_alloc(nterm ? nterm : 1, sizeof(*idf));
+	mkchar_init(&mkchar);
+	ptr[0] = 0;
+	for (t = 0; t < ntype; t++) {
+		if ((k = term_id[t]) < 0) {
+			continue;
+		}
+		SET_STRING_ELT(sterms, k,
+			       mkchar_get(&mkchar,
+					  &filter->symtab.types[t].text));
+		ptr[k + 1] = ptr[k] + df[t];
+		pos[k] = (size_t)ptr[k];
+		idf[k] = log(ndoc_obs / df[t]);
+		INTEGER(smax_tf)[k] = 0;
+		REAL(smin_len)[k] = INFINITY;
+		REAL(smax_tfidf)[k] = 0;
+	}
+
+	// distribute the postings; they are in text order, so each list is
+	// sorted by text
+	norm = REAL(snorm);
+	for (i = 0; i < n; i++) {
+		norm[i] = ISNA(length[i]) ? NA_REAL : 0;
+	}
+	for (j = 0; j < ctx->nitem; j++) {
+		RCORPUS_CHECK_INTERRUPT(j);
+
+		item = &ctx->items[j];
+		k = term_id[item->type_id];
+		INTEGER(sdoc)[pos[k]] = item->doc + 1;
+		INTEGER(stf)[pos[k]] = item->tf;
+		pos[k]++;
+
+		if (item->tf > INTEGER(smax_tf)[k]) {
+			INTEGER(smax_tf)[k] = item->tf;
+		}
+		if (length[item->doc] < REAL(smin_len)[k]) {
+			REAL(smin_len)[k] = length[item->doc];
+		}
+
+		w = (1 + log(item->tf)) * idf[k];
+		norm[item->doc] += w * w;
+	}
+	for (i = 0; i < n; i++) {
+		if (!ISNA(norm[i])) {
+			norm[i] = sqrt(norm[i]);
+		}
+	}
+	for (j = 0; j < ctx->nitem; j++) {
+		item = &ctx->items[j];
+		k = term_id[item->type_id];
+		if (norm[item->doc] > 0) {
+			w = (1 + log(item->tf)) * idf[k] / norm[item->doc];
+			if (w > REAL(smax_tfidf)[k]) {
+				REAL(smax_tfidf)[k] = w;
+			}
+		}
+	}
+	TRACE_END("text_index:postings");
+
+	PROTECT(ans = allocVector(VECSXP, 9)); nprot++;
+	PROTECT(snames = allocVector(STRSXP, 9)); nprot++;
+	SET_VECTOR_ELT(ans, 0, sterms);
+	SET_STRING_ELT(snames, 0, mkChar("terms"));
+	SET_VECTOR_ELT(ans, 1, sptr);
+	SET_STRING_ELT(snames, 1, mkChar("ptr"));
+	SET_VECTOR_ELT(ans, 2, sdoc);
+	SET_STRING_ELT(snames, 2, mkChar("doc"));
+	SET_VECTOR_ELT(ans, 3, stf);
+	SET_STRING_ELT(snames, 3, mkChar("tf"));
+	SET_VECTOR_ELT(ans, 4, smax_tf);
+	SET_STRING_ELT(snames, 4, mkChar("max_tf"));
+	SET_VECTOR_ELT(ans, 5, smin_len);
+	SET_STRING_ELT(snames, 5, mkChar("min_length"));
+	SET_VECTOR_ELT(ans, 6, smax_tfidf);
+	SET_STRING_ELT(snames, 6, mkChar("max_tfidf"));
+	SET_VECTOR_ELT(ans, 7, slength);
+	SET_STRING_ELT(snames, 7, mkChar("length"));
+	SET_VECTOR_ELT(ans, 8, snorm);
+	SET_STRING_ELT(snames, 8, mkChar("norm"));
+	setAttrib(ans, R_NamesSymbol, snames);
+
+out:
+	CHECK_ERROR(err);
+	free_context(sctx);
+	UNPROTECT(nprot);
+	return ans;
+}
+
+
+/* ranking */
+
+struct query_term {
+	int term;
+	double idf;
+	double weight;
+	double bound;
+};
+
+struct hit {
+	int doc;
+	double score;
+};
+
+struct rank_context {
+	int *query;
+	int *hit_doc;
+	double *hit_score;
+	R_xlen_t nhit;
+	R_xlen_t nhit_max;
+};
+
+
+static void rank_context_destroy(void *obj)
+{
+	struct rank_context *ctx = obj;
+
+	corpus_free(ctx->hit_score);
+	corpus_free(ctx->hit_doc);
+	corpus_free(ctx->query);
+}
+
+
+static int rank_add(struct rank_context *ctx, int query, int doc,
+		    double score)
+{
+	int *qs, *docs;
+	double *scores;
+	R_xlen_t max;
+
+	if (ctx->nhit == ctx->nhit_max) {
+		max = ctx->nhit_max ? 2 * ctx->nhit_max : 256;
+		if (!(qs = corpus_realloc(ctx->query, max * sizeof(*qs)))) {
+			return CORPUS_ERROR_NOMEM;
+		}
+		ctx->query = qs;
+		if (!(docs = corpus_realloc(ctx->hit_doc,
+					    max * sizeof(*docs)))) {
+			return CORPUS_ERROR_NOMEM;
+		}
+		ctx->hit_doc = docs;
+		if (!(scores = corpus_realloc(ctx->hit_score,
+					      max * sizeof(*scores)))) {
+			return CORPUS_ERROR_NOMEM;
+		}
+		ctx->hit_score = scores;
+		ctx->nhit_max = max;
+	}
+
+	ctx->query[ctx->nhit] = query;
+	ctx->hit_doc[ctx->nhit] = doc;
+	ctx->hit_score[ctx->nhit] = score;
+	ctx->nhit++;
+	return 0;
+}
+
+
+static int int_cmp(const void *x1, const void *x2)
+{
+	int i1 = *(const int *)x1, i2 = *(const int *)x2;
+	return (i1 > i2) - (i1 < i2);
+}
+
+
+static int query_term_cmp(const void *x1, const void *x2)
+{
+	const struct query_term *q1 = x1, *q2 = x2;
+
+	if (q1->bound != q2->bound) {
+		return (q1->bound > q2->bound) ? -1 : 1;
+	}
+	return (q1->term > q2->term) - (q1->term < q2->term);
+}
+
+
+// descending score, then ascending text
+static int hit_cmp(const void *x1, const void *x2)
+{
+	const struct hit *h1 = x1, *h2 = x2;
+
+	if (h1->score != h2->score) {
+		return (h1->score > h2->score) ? -1 : 1;
+	}
+	return (h1->doc > h2->doc) - (h1->doc < h2->doc);
+}
+
+
+// the k-th largest of x[0], ..., x[n - 1], reordering x; needs k <= n
+static double select_kth(double *x, R_xlen_t n, R_xlen_t k)
+{
+	R_xlen_t lo = 0, hi = n - 1, i, j, target = k - 1;
+	double pivot, tmp;
+
+	while (lo < hi) {
+		pivot = x[lo + (hi - lo) / 2];
+		i = lo;
+		j = hi;
+		while (i <= j) {
+			while (x[i] > pivot) i++;
+			while (x[j] < pivot) j--;
+			if (i <= j) {
+				tmp = x[i]; x[i] = x[j]; x[j] = tmp;
+				i++;
+				j--;
+			}
+		}
+		if (target <= j) {
+			hi = j;
+		} else if (target >= i) {
+			lo = i;
+		} else {
+			break;
+		}
+	}
+	return x[target];
+}
+
+
+// position of 'doc' in the sorted list, or -1
+static R_xlen_t find_doc(const int *docs, R_xlen_t n, int doc)
+{
+	R_xlen_t lo = 0, hi = n, mid;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (docs[mid] < doc) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	return (lo < n && docs[lo] == doc) ? lo : -1;
+}
+
+
+SEXP text_rank(SEXP sindex, SEXP squeries, SEXP sk, SEXP smethod, SEXP sk1,
+	       SEXP sb)
+{
+	SEXP ans = R_NilValue, sctx, snames, squery, sdoc, sscore, sq;
+	struct rank_context *ctx;
+	struct query_term *qterms;
+	struct hit *hits;
+	const double *ptr, *length, *norm, *min_len, *max_tfidf;
+	const int *doc, *tf, *max_tf, *ids, *pdoc, *ptf;
+	double *acc, *scratch, k1, b, avgdl, nobs, idf, w, qnorm, remaining,
+	       theta, dl, score;
+	R_xlen_t nquery, ndoc, nterm, npost, i, j, m, ntouched, nkeep, nid;
+	int *touched, *sorted, q, t, d, k, method, nq, and_mode, qtf,
+	    err = 0, nprot = 0;
+
+	ptr = REAL(getListElement(sindex, "ptr"));
+	doc = INTEGER(getListElement(sindex, "doc"));
+	tf = INTEGER(getListElement(sindex, "tf"));
+	max_tf = INTEGER(getListElement(sindex, "max_tf"));
+	min_len = REAL(getListElement(sindex, "min_length"));
+	max_tfidf = REAL(getListElement(sindex, "max_tfidf"));
+	length = REAL(getListElement(sindex, "length"));
+	norm = REAL(getListElement(sindex, "norm"));
+	nterm = XLENGTH(getListElement(sindex, "terms"));
+	ndoc = XLENGTH(getListElement(sindex, "length"));
+
+	nquery = XLENGTH(squeries);
+	k = INTEGER(sk)[0];
+	method = (strcmp(CHAR(STRING_ELT(smethod, 0)), "tfidf") == 0
+		  ? METHOD_TFIDF : METHOD_BM25);
+	k1 = REAL(sk1)[0];
+	b = REAL(sb)[0];
+
+	nobs = 0;
+	avgdl = 0;
+	for (i = 0; i < ndoc; i++) {
+		if (!ISNA(length[i])) {
+			nobs++;
+			avgdl += length[i];
+		}
+	}
+	avgdl = (nobs > 0) ? avgdl / nobs : 0;
+	if (avgdl == 0) {
+		avgdl = 1; // all texts are empty; any positive value works
+	}
+
+	PROTECT(sctx = alloc_context(sizeof(*ctx), rank_context_destroy));
+	nprot++;
+	ctx = as_context(sctx);
+
+	acc = (void *)R_alloc(ndoc ? ndoc : 1, sizeof(*acc));
+	memset(acc, 0, (size_t)ndoc * sizeof(*acc));
+	scratch = (void *)R_alloc(ndoc ? ndoc : 1, sizeof(*scratch));
+	touched = (void *)R_alloc(ndoc ? ndoc : 1, sizeof(*touched));
+	hits = (void *)R_alloc(ndoc ? ndoc : 1, sizeof(*hits));
+
+	nid = 0;
+	for (q = 0; q < nquery; q++) {
+		if (XLENGTH(VECTOR_ELT(squeries, q)) > nid) {
+			nid = XLENGTH(VECTOR_ELT(squeries, q));
+		}
+	}
+	sorted = (void *)R_alloc(nid ? nid : 1, sizeof(*sorted));
+	qterms = (void *)R_alloc(nid ? nid : 1, sizeof(*qterms));
+
+	TRACE_BEGIN("text_rank:score");
+	for (q = 0; q < nquery; q++) {
+		RCORPUS_CHECK_INTERRUPT(q);
+
+		// collect the distinct query terms and their frequencies
+		sq = VECTOR_ELT(squeries, q);
+		nid = XLENGTH(sq);
+		ids = INTEGER(sq);
+		m = 0;
+		for (i = 0; i < nid; i++) {
+			if (ids[i] != NA_INTEGER && 1 <= ids[i]
+			    && ids[i] <= nterm) {
+				sorted[m++] = ids[i] - 1;
+			}
+		}
+		qsort(sorted, (size_t)m, sizeof(*sorted), int_cmp);
+
+		nq = 0;
+		qnorm = 0;
+		for (i = 0; i < m; i += qtf) {
+			t = sorted[i];
+			qtf = 1;
+			while (i + qtf < m && sorted[i + qtf] == t) {
+				qtf++;
+			}
+
+			npost = (R_xlen_t)(ptr[t + 1] - ptr[t]);
+			if (method == METHOD_BM25) {
+				idf = log(1 + (nobs - npost + 0.5)
+					      / (npost + 0.5));
+				w = qtf * idf;
+				dl = min_len[t];
+				qterms[nq].bound = (w * max_tf[t] * (k1 + 1)
+					/ (max_tf[t] + k1 * (1 - b
+							     + b * dl / avgdl)));
+			} else {
+				idf = log(nobs / npost);
+				w = (1 + log(qtf)) * idf;
+				qnorm += w * w;
+				qterms[nq].bound = w * max_tfidf[t];
+			}
+			if (!(qterms[nq].bound > 0)) {
+				continue; // the term cannot change any score
+			}
+			qterms[nq].term = t;
+			qterms[nq].idf = idf;
+			qterms[nq].weight = w;
+			nq++;
+		}
+
+		if (method == METHOD_TFIDF) {
+			qnorm = sqrt(qnorm);
+			for (i = 0; i < nq; i++) {
+				qterms[i].weight /= qnorm;
+				qterms[i].bound /= qnorm;
+			}
+		}
+
+		qsort(qterms, (size_t)nq, sizeof(*qterms), query_term_cmp);
+
+		remaining = 0;
+		for (i = 0; i < nq; i++) {
+			remaining += qterms[i].bound;
+		}
+
+		ntouched = 0;
+		and_mode = 0;
+		theta = 0;
+
+		for (i = 0; i < nq; i++) {
+			t = qterms[i].term;
+			idf = qterms[i].idf;
+			w = qterms[i].weight;
+			remaining -= qterms[i].bound;
+			if (remaining < 0) {
+				remaining = 0;
+			}
+
+			pdoc = doc + (R_xlen_t)ptr[t];
+			ptf = tf + (R_xlen_t)ptr[t];
+			npost = (R_xlen_t)(ptr[t + 1] - ptr[t]);
+
+#define CONTRIB(d, f) \
+	((method == METHOD_BM25) \
+	 ? w * (f) * (k1 + 1) / ((f) + k1 * (1 - b + b * length[d] / avgdl)) \
+	 : w * (1 + log(f)) * idf / norm[d])
+
+			if (!and_mode) {
+				for (j = 0; j < npost; j++) {
+					d = pdoc[j] - 1;
+					if (acc[d] == 0) {
+						touched[ntouched++] = d;
+					}
+					acc[d] += CONTRIB(d, ptf[j]);
+				}
+			} else if ((double)ntouched * log2((double)npost + 1)
+				   < (double)npost) {
+				for (j = 0; j < ntouched; j++) {
+					d = touched[j];
+					m = find_doc(pdoc, npost, d + 1);
+					if (m >= 0) {
+						acc[d] += CONTRIB(d, ptf[m]);
+					}
+				}
+			} else {
+				for (j = 0; j < npost; j++) {
+					d = pdoc[j] - 1;
+					if (acc[d] > 0) {
+						acc[d] += CONTRIB(d, ptf[j]);
+					}
+				}
+			}
+#undef CONTRIB
+
+			if (ntouched < k) {
+				continue;
+			}
+
+			for (j = 0; j < ntouched; j++) {
+				scratch[j] = acc[touched[j]];
+			}
+			theta = select_kth(scratch, ntouched, k);
+
+			if (!and_mode && theta > remaining) {
+				and_mode = 1;
+			}
+
+			// drop the texts that cannot reach the top k
+			if (and_mode) {
+				nkeep = 0;
+				for (j = 0; j < ntouched; j++) {
+					d = touched[j];
+					if (acc[d] + remaining >= theta) {
+						touched[nkeep++] = d;
+					} else {
+						acc[d] = 0;
+					}
+				}
+				ntouched = nkeep;
+			}
+		}
+
+		// sort the candidates and take the top k
+		for (j = 0; j < ntouched; j++) {
+			d = touched[j];
+			hits[j].doc = d;
+			hits[j].score = acc[d];
+			acc[d] = 0;
+		}
+		qsort(hits, (size_t)ntouched, sizeof(*hits), hit_cmp);
+
+		for (j = 0; j < ntouched && j < k; j++) {
+			score = hits[j].score;
+			TRY(rank_add(ctx, q + 1, hits[j].doc + 1, score));
+		}
+	}
+	TRACE_END("text_rank:score");
+
+	PROTECT(squery = allocVector(INTSXP, ctx->nhit)); nprot++;
+	PROTECT(sdoc = allocVector(INTSXP, ctx->nhit)); nprot++;
+	PROTECT(sscore = allocVector(REALSXP, ctx->nhit)); nprot++;
+	if (ctx->nhit > 0) {
+		memcpy(INTEGER(squery), ctx->query,
+		       ctx->nhit * sizeof(*ctx->query));
+		memcpy(INTEGER(sdoc), ctx->hit_doc,
+		       ctx->nhit * sizeof(*ctx->hit_doc));
+		memcpy(REAL(sscore), ctx->hit_score,
+		       ctx->nhit * sizeof(*ctx->hit_score));
+	}
+
+	PROTECT(ans = allocVector(VECSXP, 3)); nprot++;
+	PROTECT(snames = allocVector(STRSXP, 3)); nprot++;
+	SET_VECTOR_ELT(ans, 0, squery);
+	SET_STRING_ELT(snames, 0, mkChar("query"));
+	SET_VECTOR_ELT(ans, 1, sdoc);
+	SET_STRING_ELT(snames, 1, mkChar("text"));
+	SET_VECTOR_ELT(ans, 2, sscore);
+	SET_STRING_ELT(snames, 2, mkChar("score"));
+	setAttrib(ans, R_NamesSymbol, snames);
+
+out:
+	CHECK_ERROR(err);
+	free_context(sctx);
+	UNPROTECT(nprot);
+	return ans;
+}
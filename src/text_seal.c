@@ -0,0 +1,87 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stddef.h>
+#include "rcorpus.h"
+
+/*
+ * Sealing a text object builds everything that the text handle would
+ * otherwise compute lazily: the text table, the filter, the sentence
+ * filter, and the filter's symbol table entries for every type in the
+ * text. Later computations on the same object start from these; subsets
+ * get new handles, and build their own.
+ */
+
+
+SEXP text_seal(SEXP sx)
+{
+	SEXP handle;
+	struct rcorpus_text *obj;
+	struct corpus_filter *filter;
+	const struct utf8lite_text *text;
+	R_xlen_t i, n;
+	int nprot = 0, err = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	text = as_text(sx, &n);
+	handle = getListElement(sx, "handle");
+	obj = R_ExternalPtrAddr(handle);
+
+	if (obj->sealed && obj->has_filter && obj->valid_filter
+			&& obj->has_sentfilter && obj->valid_sentfilter) {
+		goto out;
+	}
+
+	filter = text_filter(sx);
+	text_sentfilter(sx);
+
+	// add every type in the text to the symbol table
+	for (i = 0; i < n; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+
+		if (!text[i].ptr) {
+			continue;
+		}
+
+		TRY(corpus_filter_start(filter, &text[i]));
+		while (corpus_filter_advance(filter)) {
+		}
+		TRY(filter->error);
+	}
+
+	obj->sealed = 1;
+
+out:
+	CHECK_ERROR(err);
+	UNPROTECT(nprot);
+	return sx;
+}
+
+
+SEXP text_sealed(SEXP sx)
+{
+	SEXP handle;
+	struct rcorpus_text *obj;
+
+	if (!is_text(sx)) {
+		error("invalid 'text' object");
+	}
+
+	handle = getListElement(sx, "handle");
+	obj = R_ExternalPtrAddr(handle);
+
+	return ScalarLogical(obj && obj->sealed);
+}
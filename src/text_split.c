@@ -21,33 +21,76 @@
 
 
 struct context {
+	// eager representation: one text slice per block
 	struct utf8lite_text *block;
 	R_xlen_t *parent;
+
+	// compact representation: one offset per block (relative to the
+	// start of its parent), the first block of each parent, and the
+	// size of each parent
+	int *offset;
+	R_xlen_t *first;
+	int *size;
+	R_xlen_t nparent;
+
 	R_xlen_t nblock;
 	R_xlen_t nblock_max;
+	int compact;
 };
 
 
 static void context_destroy(void *obj)
 {
         struct context *ctx = obj;
+	corpus_free(ctx->size);
+	corpus_free(ctx->first);
+	corpus_free(ctx->offset);
 	corpus_free(ctx->block);
 	corpus_free(ctx->parent);
 }
 
 
+static void context_init(struct context *ctx, R_xlen_t nparent)
+{
+	int err = 0;
+
+	ctx->nparent = nparent;
+	ctx->compact = RCORPUS_HAS_ALTREP;
+
+	if (ctx->compact) {
+		TRY_ALLOC(ctx->first = corpus_malloc((nparent + 1)
+						     * sizeof(*ctx->first)));
+		ctx->first[0] = 0;
+
+		if (nparent > 0) {
+			TRY_ALLOC(ctx->size = corpus_malloc(
+					nparent * sizeof(*ctx->size)));
+		}
+	}
+
+out:
+	CHECK_ERROR(err);
+}
+
+
 static void context_grow(struct context *ctx, size_t nadd)
 {
 	struct utf8lite_text *block;
 	R_xlen_t *parent;
+	int *offset;
 	size_t count, size, width;
 	int err = 0;
 
 	count = (size_t)ctx->nblock;
 	size = (size_t)ctx->nblock_max;
-	width = (sizeof(*block) < sizeof(*parent)
-			? sizeof(*parent)
-			: sizeof(*block));
+
+	if (ctx->compact) {
+		width = sizeof(*offset);
+	} else {
+		width = (sizeof(*block) < sizeof(*parent)
+				? sizeof(*parent)
+				: sizeof(*block));
+	}
 
 	if (nadd <= size && count <= size - nadd) {
 		return;
@@ -55,11 +98,19 @@ static void context_grow(struct context *ctx, size_t nadd)
 
 	TRY(corpus_bigarray_size_add(&size, width, count, nadd));
 
-	TRY_ALLOC(block = corpus_realloc(ctx->block, size * sizeof(*block)));
-	ctx->block = block;
+	if (ctx->compact) {
+		TRY_ALLOC(offset = corpus_realloc(ctx->offset,
+						  size * sizeof(*offset)));
+		ctx->offset = offset;
+	} else {
+		TRY_ALLOC(block = corpus_realloc(ctx->block,
+						 size * sizeof(*block)));
+		ctx->block = block;
 
-	TRY_ALLOC(parent = corpus_realloc(ctx->parent, size * sizeof(*parent)));
-	ctx->parent = parent;
+		TRY_ALLOC(parent = corpus_realloc(ctx->parent,
+						  size * sizeof(*parent)));
+		ctx->parent = parent;
+	}
 
 	ctx->nblock_max = (R_xlen_t)size;
 out:
@@ -67,8 +118,22 @@ out:
 }
 
 
+// call once for each parent, in order, before adding its blocks
+static void context_start(struct context *ctx, R_xlen_t parent,
+			  const struct utf8lite_text *text)
+{
+	if (!ctx->compact) {
+		return;
+	}
+
+	ctx->first[parent] = ctx->nblock;
+	ctx->first[parent + 1] = ctx->nblock;
+	ctx->size[parent] = (int)UTF8LITE_TEXT_SIZE(text);
+}
+
+
 static void context_add(struct context *ctx, const struct utf8lite_text *block,
-			R_xlen_t parent)
+			R_xlen_t parent, const struct utf8lite_text *text)
 {
 	R_xlen_t nblock = ctx->nblock;
 
@@ -76,8 +141,13 @@ static void context_add(struct context *ctx, const struct utf8lite_text *block,
 		context_grow(ctx, 1);
 	}
 
-	ctx->block[nblock] = *block;
-	ctx->parent[nblock] = parent;
+	if (ctx->compact) {
+		ctx->offset[nblock] = (int)(block->ptr - text->ptr);
+		ctx->first[parent + 1] = nblock + 1;
+	} else {
+		ctx->block[nblock] = *block;
+		ctx->parent[nblock] = parent;
+	}
 	ctx->nblock = nblock + 1;
 }
 
@@ -86,6 +156,7 @@ static void context_trim(struct context *ctx)
 {
 	struct utf8lite_text *block;
 	R_xlen_t *parent;
+	int *offset;
 	size_t size = (size_t)ctx->nblock;
 
 	if (size == 0) {
@@ -94,6 +165,14 @@ static void context_trim(struct context *ctx)
 
 		corpus_free(ctx->parent);
 		ctx->parent = NULL;
+
+		corpus_free(ctx->offset);
+		ctx->offset = NULL;
+	} else if (ctx->compact) {
+		offset = corpus_realloc(ctx->offset, size * sizeof(*offset));
+		if (offset) {
+			ctx->offset = offset;
+		}
 	} else {
 		block = corpus_realloc(ctx->block, size * sizeof(*block));
 		if (block) {
@@ -110,11 +189,42 @@ static void context_trim(struct context *ctx)
 }
 
 
+static SEXP context_frame(SEXP sparent, SEXP index, SEXP stext,
+			  R_xlen_t nblock)
+{
+	SEXP ans, names, row_names, sclass;
+	int nprot = 0;
+
+	PROTECT(ans = allocVector(VECSXP, 3)); nprot++;
+	SET_VECTOR_ELT(ans, 0, sparent);
+	SET_VECTOR_ELT(ans, 1, index);
+	SET_VECTOR_ELT(ans, 2, stext);
+
+	PROTECT(names = allocVector(STRSXP, 3)); nprot++;
+	SET_STRING_ELT(names, 0, mkChar("parent"));
+	SET_STRING_ELT(names, 1, mkChar("index"));
+	SET_STRING_ELT(names, 2, mkChar("text"));
+	setAttrib(ans, R_NamesSymbol, names);
+
+	PROTECT(row_names = allocVector(REALSXP, 2)); nprot++;
+	REAL(row_names)[0] = NA_REAL;
+	REAL(row_names)[1] = -(double)nblock;
+	setAttrib(ans, R_RowNamesSymbol, row_names);
+
+	PROTECT(sclass = allocVector(STRSXP, 2)); nprot++;
+        SET_STRING_ELT(sclass, 0, mkChar("corpus_frame"));
+        SET_STRING_ELT(sclass, 1, mkChar("data.frame"));
+        setAttrib(ans, R_ClassSymbol, sclass);
+
+	UNPROTECT(nprot);
+	return ans;
+}
+
+
 static SEXP context_make(struct context *ctx, SEXP sx)
 {
 	SEXP ans, handle, sources, psource, prow, pstart, ptable, source,
-	     row, start, stop, index, sparent, stext, names, filter,
-	     sclass, row_names;
+	     row, start, stop, index, sparent, stext, filter;
 	struct rcorpus_text *obj;
 	R_xlen_t src, i, iblock, nblock;
 	double r;
@@ -136,7 +246,7 @@ static SEXP context_make(struct context *ctx, SEXP sx)
 	PROTECT(row = allocVector(REALSXP, nblock)); nprot++;
 	PROTECT(start = allocVector(INTSXP, nblock)); nprot++;
 	PROTECT(stop = allocVector(INTSXP, nblock)); nprot++;
-	PROTECT(sparent = allocVector(REALSXP, nblock)); nprot++;
+	PROTECT(sparent = allocVector(INTSXP, nblock)); nprot++;
 	PROTECT(index = allocVector(INTSXP, nblock)); nprot++;
 
 	i = -1;
@@ -162,7 +272,7 @@ static SEXP context_make(struct context *ctx, SEXP sx)
 		INTEGER(start)[iblock] = off;
 		INTEGER(stop)[iblock] = off + (len - 1);
 		INTEGER(index)[iblock] = j + 1;
-		REAL(sparent)[iblock] = (double)i + 1;
+		INTEGER(sparent)[iblock] = (int)(i + 1);
 
 		j++;
 		off += len;
@@ -184,33 +294,415 @@ static SEXP context_make(struct context *ctx, SEXP sx)
 	obj->length = nblock;
 	ctx->block = NULL;
 
-	PROTECT(ans = allocVector(VECSXP, 3)); nprot++;
-	SET_VECTOR_ELT(ans, 0, sparent);
-	SET_VECTOR_ELT(ans, 1, index);
-	SET_VECTOR_ELT(ans, 2, stext);
+	PROTECT(ans = context_frame(sparent, index, stext, nblock)); nprot++;
 
-	PROTECT(names = allocVector(STRSXP, 3)); nprot++;
-	SET_STRING_ELT(names, 0, mkChar("parent"));
-	SET_STRING_ELT(names, 1, mkChar("index"));
-	SET_STRING_ELT(names, 2, mkChar("text"));
-	setAttrib(ans, R_NamesSymbol, names);
+out:
+	CHECK_ERROR(err);
+	UNPROTECT(nprot);
+	return ans;
+}
 
-	PROTECT(row_names = allocVector(REALSXP, 2)); nprot++;
-	REAL(row_names)[0] = NA_REAL;
-	REAL(row_names)[1] = -(double)nblock;
-	setAttrib(ans, R_RowNamesSymbol, row_names);
 
-	PROTECT(sclass = allocVector(STRSXP, 2)); nprot++;
-        SET_STRING_ELT(sclass, 0, mkChar("corpus_frame"));
-        SET_STRING_ELT(sclass, 1, mkChar("data.frame"));
-        setAttrib(ans, R_ClassSymbol, sclass);
+#if RCORPUS_HAS_ALTREP
+
+/*
+ * Lazy split results. Rather than materializing the block table, we store
+ * one byte offset per block along with the first block and size of each
+ * parent. The 'parent' and 'index' columns and the 'source', 'row',
+ * 'start', and 'stop' columns of the text table are ALTREP vectors that
+ * compute their values from this compact representation on access.
+ */
+
+#include <R_ext/Altrep.h>
+
+enum split_field {
+	SPLIT_PARENT = 0,
+	SPLIT_INDEX,
+	SPLIT_SOURCE,
+	SPLIT_ROW,
+	SPLIT_START,
+	SPLIT_STOP
+};
+
+struct split {
+	int *offset;
+	R_xlen_t *first;
+	int *size;
+	R_xlen_t nparent;
+	R_xlen_t nblock;
+	SEXP psource;
+	SEXP prow;
+	SEXP pstart;
+};
+
+static R_altrep_class_t split_int_class;
+static R_altrep_class_t split_real_class;
+
+
+static void split_destroy(void *obj)
+{
+	struct split *sp = obj;
+	corpus_free(sp->size);
+	corpus_free(sp->first);
+	corpus_free(sp->offset);
+}
+
+
+static const struct split *split_get(SEXP x, int *fieldptr)
+{
+	SEXP data = R_altrep_data1(x);
+
+	if (fieldptr) {
+		*fieldptr = INTEGER(VECTOR_ELT(data, 1))[0];
+	}
+	return as_context(VECTOR_ELT(data, 0));
+}
+
+
+// find the parent of a block: the largest i with first[i] <= iblock
+static R_xlen_t split_parent(const struct split *sp, R_xlen_t iblock)
+{
+	R_xlen_t lo = 0, hi = sp->nparent, mid;
+
+	while (hi - lo > 1) {
+		mid = lo + (hi - lo) / 2;
+		if (sp->first[mid] <= iblock) {
+			lo = mid;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+
+static double split_value(const struct split *sp, int field, R_xlen_t i,
+			  R_xlen_t iblock)
+{
+	int off;
+
+	switch (field) {
+	case SPLIT_PARENT:
+		return (double)(i + 1);
+
+	case SPLIT_INDEX:
+		return (double)(iblock - sp->first[i] + 1);
+
+	case SPLIT_SOURCE:
+		return (double)INTEGER_ELT(sp->psource, i);
+
+	case SPLIT_ROW:
+		return REAL_ELT(sp->prow, i);
+
+	case SPLIT_START:
+		return (double)INTEGER_ELT(sp->pstart, i)
+			+ sp->offset[iblock];
+
+	default: // SPLIT_STOP
+		off = ((iblock + 1 < sp->first[i + 1])
+		       ? sp->offset[iblock + 1]
+		       : sp->size[i]);
+		return (double)INTEGER_ELT(sp->pstart, i) + (off - 1);
+	}
+}
+
+
+static R_xlen_t split_get_region(const struct split *sp, int field,
+				 R_xlen_t start, R_xlen_t len, int *ibuf,
+				 double *dbuf)
+{
+	R_xlen_t i, k, iblock;
+	double val;
+
+	if (start >= sp->nblock) {
+		return 0;
+	}
+	if (len > sp->nblock - start) {
+		len = sp->nblock - start;
+	}
+
+	i = split_parent(sp, start);
+
+	for (k = 0; k < len; k++) {
+		iblock = start + k;
+		while (sp->first[i + 1] <= iblock) {
+			i++;
+		}
+
+		val = split_value(sp, field, i, iblock);
+		if (ibuf) {
+			ibuf[k] = (int)val;
+		} else {
+			dbuf[k] = val;
+		}
+	}
+
+	return len;
+}
+
+
+static SEXP split_materialize(SEXP x)
+{
+	SEXP ans = R_altrep_data2(x);
+	const struct split *sp;
+	int field;
+
+	if (ans != R_NilValue) {
+		return ans;
+	}
+
+	sp = split_get(x, &field);
+	if (field == SPLIT_ROW) {
+		PROTECT(ans = allocVector(REALSXP, sp->nblock));
+		split_get_region(sp, field, 0, sp->nblock, NULL, REAL(ans));
+	} else {
+		PROTECT(ans = allocVector(INTSXP, sp->nblock));
+		split_get_region(sp, field, 0, sp->nblock, INTEGER(ans), NULL);
+	}
+
+	R_set_altrep_data2(x, ans);
+	UNPROTECT(1);
+	return ans;
+}
+
+
+static R_xlen_t split_length(SEXP x)
+{
+	return split_get(x, NULL)->nblock;
+}
+
+
+static void *split_dataptr(SEXP x, Rboolean writeable)
+{
+	return DATAPTR(split_materialize(x));
+}
+
+
+static const void *split_dataptr_or_null(SEXP x)
+{
+	SEXP data = R_altrep_data2(x);
+	return (data == R_NilValue) ? NULL : DATAPTR_RO(data);
+}
+
+
+static SEXP split_duplicate(SEXP x, Rboolean deep)
+{
+	SEXP data = R_altrep_data2(x);
+
+	if (data != R_NilValue) {
+		return NULL; // use the default method
+	}
+
+	// share the compact representation
+	if (TYPEOF(x) == REALSXP) {
+		return R_new_altrep(split_real_class, R_altrep_data1(x),
+				    R_NilValue);
+	} else {
+		return R_new_altrep(split_int_class, R_altrep_data1(x),
+				    R_NilValue);
+	}
+}
+
+
+static SEXP split_serialized_state(SEXP x)
+{
+	return split_materialize(x);
+}
+
+
+static SEXP split_unserialize(SEXP cls, SEXP state)
+{
+	return state;
+}
+
+
+static int split_int_elt(SEXP x, R_xlen_t i)
+{
+	SEXP data = R_altrep_data2(x);
+	const struct split *sp;
+	int field, val;
+
+	if (data != R_NilValue) {
+		return INTEGER(data)[i];
+	}
+
+	sp = split_get(x, &field);
+	split_get_region(sp, field, i, 1, &val, NULL);
+	return val;
+}
+
+
+static double split_real_elt(SEXP x, R_xlen_t i)
+{
+	SEXP data = R_altrep_data2(x);
+	const struct split *sp;
+	double val;
+	int field;
+
+	if (data != R_NilValue) {
+		return REAL(data)[i];
+	}
+
+	sp = split_get(x, &field);
+	split_get_region(sp, field, i, 1, NULL, &val);
+	return val;
+}
+
+
+static R_xlen_t split_int_get_region(SEXP x, R_xlen_t i, R_xlen_t n,
+				     int *buf)
+{
+	const struct split *sp;
+	int field;
+
+	sp = split_get(x, &field);
+	return split_get_region(sp, field, i, n, buf, NULL);
+}
+
+
+static R_xlen_t split_real_get_region(SEXP x, R_xlen_t i, R_xlen_t n,
+				      double *buf)
+{
+	const struct split *sp;
+	int field;
+
+	sp = split_get(x, &field);
+	return split_get_region(sp, field, i, n, NULL, buf);
+}
+
+
+void init_split_altrep(DllInfo *dll)
+{
+	R_altrep_class_t cls;
+
+	cls = R_make_altinteger_class("corpus_split_int", "corpus", dll);
+	R_set_altrep_Length_method(cls, split_length);
+	R_set_altrep_Duplicate_method(cls, split_duplicate);
+	R_set_altrep_Serialized_state_method(cls, split_serialized_state);
+	R_set_altrep_Unserialize_method(cls, split_unserialize);
+	R_set_altvec_Dataptr_method(cls, split_dataptr);
+	R_set_altvec_Dataptr_or_null_method(cls, split_dataptr_or_null);
+	R_set_altinteger_Elt_method(cls, split_int_elt);
+	R_set_altinteger_Get_region_method(cls, split_int_get_region);
+	split_int_class = cls;
+
+	cls = R_make_altreal_class("corpus_split_real", "corpus", dll);
+	R_set_altrep_Length_method(cls, split_length);
+	R_set_altrep_Duplicate_method(cls, split_duplicate);
+	R_set_altrep_Serialized_state_method(cls, split_serialized_state);
+	R_set_altrep_Unserialize_method(cls, split_unserialize);
+	R_set_altvec_Dataptr_method(cls, split_dataptr);
+	R_set_altvec_Dataptr_or_null_method(cls, split_dataptr_or_null);
+	R_set_altreal_Elt_method(cls, split_real_elt);
+	R_set_altreal_Get_region_method(cls, split_real_get_region);
+	split_real_class = cls;
+}
+
+
+static SEXP split_column(SEXP ssplit, int field)
+{
+	SEXP ans, data;
+	int nprot = 0;
+
+	PROTECT(data = allocVector(VECSXP, 2)); nprot++;
+	SET_VECTOR_ELT(data, 0, ssplit);
+	SET_VECTOR_ELT(data, 1, ScalarInteger(field));
+
+	if (field == SPLIT_ROW) {
+		PROTECT(ans = R_new_altrep(split_real_class, data,
+					   R_NilValue)); nprot++;
+	} else {
+		PROTECT(ans = R_new_altrep(split_int_class, data,
+					   R_NilValue)); nprot++;
+	}
+
+	UNPROTECT(nprot);
+	return ans;
+}
+
+
+static SEXP context_make_compact(struct context *ctx, SEXP sx)
+{
+	SEXP ans, ssplit, sources, ptable, source, row, start, stop, index,
+	     sparent, stext, filter;
+	struct split *sp;
+	int nprot = 0;
+
+	context_trim(ctx);
+
+	filter = filter_text(sx);
+	sources = getListElement(sx, "sources");
+	ptable = getListElement(sx, "table");
+
+	PROTECT(ssplit = alloc_context(sizeof(*sp), split_destroy)); nprot++;
+	sp = as_context(ssplit);
+
+	// keep the parent table alive for as long as the columns need it
+	R_SetExternalPtrProtected(ssplit, ptable);
+	sp->psource = getListElement(ptable, "source");
+	sp->prow = getListElement(ptable, "row");
+	sp->pstart = getListElement(ptable, "start");
+
+	// transfer ownership of the offsets
+	sp->offset = ctx->offset;
+	sp->first = ctx->first;
+	sp->size = ctx->size;
+	sp->nparent = ctx->nparent;
+	sp->nblock = ctx->nblock;
+	ctx->offset = NULL;
+	ctx->first = NULL;
+	ctx->size = NULL;
+	ctx->nblock = 0;
+	ctx->nblock_max = 0;
+
+	PROTECT(sparent = split_column(ssplit, SPLIT_PARENT)); nprot++;
+	PROTECT(index = split_column(ssplit, SPLIT_INDEX)); nprot++;
+	PROTECT(source = split_column(ssplit, SPLIT_SOURCE)); nprot++;
+	PROTECT(row = split_column(ssplit, SPLIT_ROW)); nprot++;
+	PROTECT(start = split_column(ssplit, SPLIT_START)); nprot++;
+	PROTECT(stop = split_column(ssplit, SPLIT_STOP)); nprot++;
+
+	// the text handle gets loaded from the table on first use
+	PROTECT(stext = alloc_text(sources, source, row, start, stop,
+				   R_NilValue, filter));
+	nprot++;
+
+	PROTECT(ans = context_frame(sparent, index, stext, sp->nblock));
+	nprot++;
 
-out:
-	CHECK_ERROR(err);
 	UNPROTECT(nprot);
 	return ans;
 }
 
+#else /* !RCORPUS_HAS_ALTREP */
+
+void init_split_altrep(DllInfo *dll)
+{
+	(void)dll;
+}
+
+
+static SEXP context_make_compact(struct context *ctx, SEXP sx)
+{
+	(void)ctx;
+	(void)sx;
+	error("internal error: compact split results are not available");
+	return R_NilValue;
+}
+
+#endif /* RCORPUS_HAS_ALTREP */
+
+
+static SEXP context_result(struct context *ctx, SEXP sx)
+{
+	if (ctx->compact) {
+		return context_make_compact(ctx, sx);
+	} else {
+		return context_make(ctx, sx);
+	}
+}
+
 
 SEXP text_split_sentences(SEXP sx, SEXP ssize)
 {
@@ -248,16 +740,19 @@ SEXP text_split_sentences(SEXP sx, SEXP ssize)
 
 	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy)); nprot++;
         ctx = as_context(sctx);
+	context_init(ctx, n);
 
 	for (i = 0; i < n; i++) {
 		RCORPUS_CHECK_INTERRUPT(i);
 
+		context_start(ctx, i, &text[i]);
+
 		if (!text[i].ptr) { // missing value
 			continue;
 		}
 
 		if (UTF8LITE_TEXT_SIZE(&text[i]) == 0) { // empty text
-			context_add(ctx, &text[i], i);
+			context_add(ctx, &text[i], i, &text[i]);
 			continue;
 		}
 
@@ -293,7 +788,7 @@ SEXP text_split_sentences(SEXP sx, SEXP ssize)
 			}
 
 			current.attr = attr | size;
-			context_add(ctx, &current, i);
+			context_add(ctx, &current, i, &text[i]);
 
 			s = 0;
 
@@ -308,11 +803,11 @@ SEXP text_split_sentences(SEXP sx, SEXP ssize)
 
 		if (s > 0) {
 			current.attr = attr | size;
-			context_add(ctx, &current, i);
+			context_add(ctx, &current, i, &text[i]);
 		}
 	}
 
-	PROTECT(ans = context_make(ctx, sx)); nprot++;
+	PROTECT(ans = context_result(ctx, sx)); nprot++;
 out:
         free_context(sctx);
 	CHECK_ERROR(err);
@@ -357,16 +852,19 @@ SEXP text_split_tokens(SEXP sx, SEXP ssize)
 
 	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy)); nprot++;
         ctx = as_context(sctx);
+	context_init(ctx, n);
 
 	for (i = 0; i < n; i++) {
 		RCORPUS_CHECK_INTERRUPT(i);
 
+		context_start(ctx, i, &text[i]);
+
 		if (!text[i].ptr) { // missing value
 			continue;
 		}
 
 		if (UTF8LITE_TEXT_SIZE(&text[i]) == 0) { // empty text
-			context_add(ctx, &text[i], i);
+			context_add(ctx, &text[i], i, &text[i]);
 			continue;
 		}
 
@@ -393,7 +891,7 @@ SEXP text_split_tokens(SEXP sx, SEXP ssize)
 			// token and the block is already full, add it
 			if (filter->type_id >= 0 && s >= target) {
 				current.attr = attr | size;
-				context_add(ctx, &current, i);
+				context_add(ctx, &current, i, &text[i]);
 				size = 0;
 				s = 0;
 
@@ -425,11 +923,11 @@ SEXP text_split_tokens(SEXP sx, SEXP ssize)
 
 		if (size > 0) {
 			current.attr = attr | size;
-			context_add(ctx, &current, i);
+			context_add(ctx, &current, i, &text[i]);
 		}
 	}
 
-	PROTECT(ans = context_make(ctx, sx)); nprot++;
+	PROTECT(ans = context_result(ctx, sx)); nprot++;
 out:
 	free_context(sctx);
 	CHECK_ERROR(err);
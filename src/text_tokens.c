@@ -20,6 +20,10 @@
 #include "corpus/src/array.h"
 #include "rcorpus.h"
 
+#if RCORPUS_HAS_ALTLIST
+#  include <R_ext/Altrep.h>
+#endif
+
 
 struct tokens {
 	struct corpus_filter *filter;
@@ -39,6 +43,7 @@ static void tokens_clear_tokens(struct tokens *ctx);
 static void tokens_add_token(struct tokens *ctx, int type_id);
 static SEXP tokens_add_type(struct tokens *ctx, int type_id);
 static SEXP tokens_scan(struct tokens *ctx, const struct utf8lite_text *text);
+static SEXP tokens_list(SEXP sx);
 
 
 void tokens_init(struct tokens *ctx, struct corpus_filter *filter)
@@ -167,9 +172,9 @@ out:
 }
 
 
-SEXP text_tokens(SEXP sx)
+SEXP tokens_list(SEXP sx)
 {
-	SEXP ans, names;
+	SEXP ans;
 	const struct utf8lite_text *text;
 	struct corpus_filter *filter;
 	struct tokens ctx;
@@ -178,13 +183,10 @@ SEXP text_tokens(SEXP sx)
 
 	nprot = 0;
 
-	PROTECT(sx = coerce_text(sx)); nprot++;
 	text = as_text(sx, &n);
 	filter = text_filter(sx);
 
 	PROTECT(ans = allocVector(VECSXP, n)); nprot++;
-	names = names_text(sx);
-	setAttrib(ans, R_NamesSymbol, names);
 
 	tokens_init(&ctx, filter);
 
@@ -195,11 +197,193 @@ SEXP text_tokens(SEXP sx)
 		PROTECT(tokens_add_type(&ctx, type_id)); nprot++;
 	}
 
+	TRACE_BEGIN("text_tokens:scan");
 	for (i = 0; i < n; i++) {
 		RCORPUS_CHECK_INTERRUPT(i);
 		SET_VECTOR_ELT(ans, i, tokens_scan(&ctx, &text[i]));
 	}
+	TRACE_END("text_tokens:scan");
+
+	UNPROTECT(nprot);
+	return ans;
+}
+
+
+#if RCORPUS_HAS_ALTLIST
+
+/*
+ * Lazy token lists. The ALTREP object holds the text in 'data1'. Elements
+ * get computed on access by re-running the filter on a single document;
+ * 'data2' holds the fully materialized list once something asks for a
+ * data pointer.
+ */
+
+static R_altrep_class_t tokens_class;
+
+
+static SEXP tokens_materialize(SEXP x)
+{
+	SEXP list = R_altrep_data2(x);
+
+	if (list == R_NilValue) {
+		PROTECT(list = tokens_list(R_altrep_data1(x)));
+		R_set_altrep_data2(x, list);
+		UNPROTECT(1);
+	}
+
+	return list;
+}
+
+
+static R_xlen_t tokens_length(SEXP x)
+{
+	R_xlen_t n;
+
+	as_text(R_altrep_data1(x), &n);
+	return n;
+}
+
+
+static SEXP tokens_elt(SEXP x, R_xlen_t i)
+{
+	SEXP ans, sx, list;
+	const struct utf8lite_text *text, *type;
+	struct corpus_filter *filter;
+	struct tokens ctx;
+	const void *vmax;
+	int err = 0, type_id, j;
+
+	list = R_altrep_data2(x);
+	if (list != R_NilValue) {
+		return VECTOR_ELT(list, i);
+	}
+
+	ans = R_NilValue;
+	sx = R_altrep_data1(x);
+	text = as_text(sx, NULL);
+	filter = text_filter(sx);
+
+	if (!text[i].ptr) {
+		return ScalarString(NA_STRING);
+	}
+
+	vmax = vmaxget();
+	tokens_init(&ctx, filter);
+
+	TRY(corpus_filter_start(filter, &text[i]));
+	while (corpus_filter_advance(filter)) {
+		type_id = filter->type_id;
+		if (type_id >= 0) {
+			tokens_add_token(&ctx, type_id);
+		}
+	}
+	TRY(filter->error);
+
+	PROTECT(ans = allocVector(STRSXP, ctx.ntoken));
+	for (j = 0; j < ctx.ntoken; j++) {
+		RCORPUS_CHECK_INTERRUPT(j);
+
+		type = &filter->symtab.types[ctx.tokens[j]].text;
+		SET_STRING_ELT(ans, j, mkCharLenCE((char *)type->ptr,
+						   UTF8LITE_TEXT_SIZE(type),
+						   CE_UTF8));
+	}
+	UNPROTECT(1);
+
+out:
+	vmaxset(vmax);
+	CHECK_ERROR(err);
+	return ans;
+}
+
+
+static void tokens_set_elt(SEXP x, R_xlen_t i, SEXP v)
+{
+	SET_VECTOR_ELT(tokens_materialize(x), i, v);
+}
+
+
+static void *tokens_dataptr(SEXP x, Rboolean writeable)
+{
+	return DATAPTR(tokens_materialize(x));
+}
+
+
+static const void *tokens_dataptr_or_null(SEXP x)
+{
+	SEXP list = R_altrep_data2(x);
+	return (list == R_NilValue) ? NULL : DATAPTR_RO(list);
+}
+
+
+static SEXP tokens_serialized_state(SEXP x)
+{
+	// serialize as an ordinary list; the text handle can't be saved
+	return tokens_materialize(x);
+}
+
+
+static SEXP tokens_unserialize(SEXP cls, SEXP state)
+{
+	return state;
+}
+
+
+void init_tokens_altrep(DllInfo *dll)
+{
+	tokens_class = R_make_altlist_class("corpus_tokens", "corpus", dll);
+	R_set_altrep_Length_method(tokens_class, tokens_length);
+	R_set_altrep_Serialized_state_method(tokens_class,
+					     tokens_serialized_state);
+	R_set_altrep_Unserialize_method(tokens_class, tokens_unserialize);
+	R_set_altvec_Dataptr_method(tokens_class, tokens_dataptr);
+	R_set_altvec_Dataptr_or_null_method(tokens_class,
+					    tokens_dataptr_or_null);
+	R_set_altlist_Elt_method(tokens_class, tokens_elt);
+	R_set_altlist_Set_elt_method(tokens_class, tokens_set_elt);
+}
+
+
+SEXP text_tokens(SEXP sx)
+{
+	SEXP ans, names;
+	int nprot = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+
+	// load the text and build the filter now so that errors surface here
+	// rather than on first element access
+	as_text(sx, NULL);
+	text_filter(sx);
+
+	PROTECT(ans = R_new_altrep(tokens_class, sx, R_NilValue)); nprot++;
+	names = names_text(sx);
+	setAttrib(ans, R_NamesSymbol, names);
 
 	UNPROTECT(nprot);
 	return ans;
 }
+
+#else /* !RCORPUS_HAS_ALTLIST */
+
+void init_tokens_altrep(DllInfo *dll)
+{
+	(void)dll;
+}
+
+
+SEXP text_tokens(SEXP sx)
+{
+	SEXP ans, names;
+	int nprot = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	PROTECT(ans = tokens_list(sx)); nprot++;
+	names = names_text(sx);
+	setAttrib(ans, R_NamesSymbol, names);
+
+	UNPROTECT(nprot);
+	return ans;
+}
+
+#endif /* RCORPUS_HAS_ALTLIST */
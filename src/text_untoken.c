@@ -0,0 +1,176 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <limits.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rcorpus.h"
+
+/*
+ * Untokenizing renders the tokens of each text into a single buffer,
+ * separated by 'sep'. Within a token from a combined multi-word phrase,
+ * the filter's connector (which stands in for the spaces) gets replaced
+ * by 'join'. We tell these tokens apart by the spaces in their original
+ * text; a connector character in any other token is the user's own, and
+ * stays as it is. The result is a text object with the buffer, copied to a raw
+ * vector, as its only source.
+ */
+
+struct context {
+	struct utf8lite_render render;
+	int has_render;
+};
+
+
+static void context_destroy(void *obj)
+{
+	struct context *ctx = obj;
+
+	if (ctx->has_render) {
+		utf8lite_render_destroy(&ctx->render);
+	}
+}
+
+
+// whether a token spans several words, which only happens when the
+// filter combines them into a phrase
+static int is_combined(const struct utf8lite_text *token)
+{
+	struct utf8lite_text_iter it;
+
+	utf8lite_text_iter_make(&it, token);
+	while (utf8lite_text_iter_advance(&it)) {
+		if (utf8lite_isspace(it.current)) {
+			return 1;
+		}
+	}
+	return 0;
+}
+
+
+static void render_type(struct utf8lite_render *r,
+			const struct utf8lite_text *type, int32_t connector,
+			const char *join, int combined)
+{
+	struct utf8lite_text_iter it;
+
+	if (!join || !combined) {
+		utf8lite_render_text(r, type);
+		return;
+	}
+
+	utf8lite_text_iter_make(&it, type);
+	while (utf8lite_text_iter_advance(&it)) {
+		if (it.current == connector) {
+			utf8lite_render_string(r, join);
+		} else {
+			utf8lite_render_char(r, it.current);
+		}
+	}
+}
+
+
+SEXP text_untoken(SEXP sx, SEXP ssep, SEXP sjoin)
+{
+	SEXP ans = R_NilValue, sctx, sources, source, row, start, stop, raw;
+	const struct utf8lite_text *text, *type;
+	struct corpus_filter *filter;
+	struct context *ctx;
+	const char *sep, *join;
+	R_xlen_t i, n;
+	int ntoken, type_id, nprot = 0, err = 0;
+
+	PROTECT(sx = coerce_text(sx)); nprot++;
+	text = as_text(sx, &n);
+	filter = text_filter(sx);
+
+	sep = translateCharUTF8(STRING_ELT(ssep, 0));
+	if (sjoin == R_NilValue) {
+		join = NULL;
+	} else {
+		join = translateCharUTF8(STRING_ELT(sjoin, 0));
+	}
+
+	PROTECT(sctx = alloc_context(sizeof(*ctx), context_destroy)); nprot++;
+	ctx = as_context(sctx);
+
+	TRY(utf8lite_render_init(&ctx->render, UTF8LITE_ESCAPE_NONE));
+	ctx->has_render = 1;
+
+	PROTECT(source = allocVector(INTSXP, n)); nprot++;
+	PROTECT(row = allocVector(REALSXP, n)); nprot++;
+	PROTECT(start = allocVector(INTSXP, n)); nprot++;
+	PROTECT(stop = allocVector(INTSXP, n)); nprot++;
+
+	for (i = 0; i < n; i++) {
+		RCORPUS_CHECK_INTERRUPT(i);
+
+		INTEGER(source)[i] = 1;
+		REAL(row)[i] = 1;
+
+		if (!text[i].ptr) { // missing value
+			INTEGER(start)[i] = NA_INTEGER;
+			INTEGER(stop)[i] = NA_INTEGER;
+			continue;
+		}
+
+		if (ctx->render.length == INT_MAX) {
+			err = CORPUS_ERROR_OVERFLOW;
+			goto out;
+		}
+		INTEGER(start)[i] = ctx->render.length + 1;
+
+		ntoken = 0;
+		TRY(corpus_filter_start(filter, &text[i]));
+		while (corpus_filter_advance(filter)) {
+			type_id = filter->type_id;
+			if (type_id < 0) {
+				continue;
+			}
+
+			if (ntoken > 0) {
+				utf8lite_render_string(&ctx->render, sep);
+			}
+			type = &filter->symtab.types[type_id].text;
+			render_type(&ctx->render, type, filter->connector, join,
+				    join && is_combined(&filter->current));
+			ntoken++;
+		}
+		TRY(filter->error);
+		TRY(ctx->render.error);
+
+		INTEGER(stop)[i] = ctx->render.length;
+	}
+
+	PROTECT(raw = allocVector(RAWSXP, ctx->render.length)); nprot++;
+	if (ctx->render.length > 0) {
+		memcpy(RAW(raw), ctx->render.string, ctx->render.length);
+	}
+
+	PROTECT(sources = allocVector(VECSXP, 1)); nprot++;
+	SET_VECTOR_ELT(sources, 0, raw);
+
+	PROTECT(ans = alloc_text(sources, source, row, start, stop,
+				 getListElement(sx, "names"), R_NilValue));
+	nprot++;
+
+out:
+	CHECK_ERROR(err);
+	free_context(sctx);
+	UNPROTECT(nprot);
+	return ans;
+}
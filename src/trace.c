@@ -0,0 +1,322 @@
+/*
+ * Copyright 2017 Patrick O. Perry.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rcorpus.h"
+
+/*
+ * Tracing records begin and end events from the native code, with
+ * timestamps and thread ids, and writes them in the Chrome trace event
+ * format (the "JSON Array Format" wrapped in a "traceEvents" object).
+ *
+ * Recording can happen on worker threads, so it never calls the R API and
+ * silently drops events when it runs out of memory. Event names must be
+ * string literals, since we store the pointers.
+ *
+ * An R error can jump out of a phase before it records its end. Raising
+ * an error through CHECK_ERROR records an unwind event ('U') that ends
+ * every open phase on the thread; for other jumps (interrupts, errors
+ * from the R API), we end a phase that never closed at the thread's last
+ * event before the phase starts again, or before the end of the trace.
+ * When writing the file, we drop end events without a matching begin, so
+ * the output is always balanced.
+ */
+
+struct trace_event {
+	const char *name;
+	uint64_t ts;
+	int tid;
+	char phase;
+};
+
+int rcorpus_trace_enabled = 0;
+
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct trace_event *trace_events;
+static size_t trace_nevent, trace_nevent_max;
+static pthread_t *trace_threads;
+static int trace_nthread, trace_nthread_max;
+static uint64_t trace_start_ts;
+
+
+static uint64_t trace_now(void)
+{
+	struct timespec t;
+
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return (uint64_t)t.tv_sec * 1000000 + (uint64_t)t.tv_nsec / 1000;
+}
+
+
+// small sequential ids for the threads, in the order we first see them;
+// call with the mutex held
+static int trace_thread_id(void)
+{
+	pthread_t self = pthread_self(), *threads;
+	int i, max;
+
+	for (i = 0; i < trace_nthread; i++) {
+		if (pthread_equal(trace_threads[i], self)) {
+			return i + 1;
+		}
+	}
+
+	if (trace_nthread == trace_nthread_max) {
+		max = trace_nthread_max ? 2 * trace_nthread_max : 16;
+		threads = corpus_realloc(trace_threads,
+					 (size_t)max * sizeof(*threads));
+		if (!threads) {
+			return 0;
+		}
+		trace_threads = threads;
+		trace_nthread_max = max;
+	}
+
+	trace_threads[trace_nthread++] = self;
+	return trace_nthread;
+}
+
+
+void rcorpus_trace_event(const char *name, char phase)
+{
+	struct trace_event *events;
+	uint64_t ts = trace_now();
+	size_t max;
+
+	pthread_mutex_lock(&trace_mutex);
+
+	if (!rcorpus_trace_enabled) {
+		goto out;
+	}
+
+	if (trace_nevent == trace_nevent_max) {
+		max = trace_nevent_max ? 2 * trace_nevent_max : 4096;
+		events = corpus_realloc(trace_events, max * sizeof(*events));
+		if (!events) {
+			goto out;
+		}
+		trace_events = events;
+		trace_nevent_max = max;
+	}
+
+	events = &trace_events[trace_nevent++];
+	events->name = name;
+	events->ts = ts - trace_start_ts;
+	events->tid = trace_thread_id();
+	events->phase = phase;
+
+out:
+	pthread_mutex_unlock(&trace_mutex);
+}
+
+
+static void trace_clear(void)
+{
+	corpus_free(trace_events);
+	trace_events = NULL;
+	trace_nevent = 0;
+	trace_nevent_max = 0;
+
+	corpus_free(trace_threads);
+	trace_threads = NULL;
+	trace_nthread = 0;
+	trace_nthread_max = 0;
+}
+
+
+SEXP trace_start(void)
+{
+	pthread_mutex_lock(&trace_mutex);
+	if (rcorpus_trace_enabled) {
+		pthread_mutex_unlock(&trace_mutex);
+		error("tracing is already on");
+	}
+	trace_clear();
+	trace_start_ts = trace_now();
+	rcorpus_trace_enabled = 1;
+
+	// the calling thread is thread 1
+	trace_thread_id();
+	pthread_mutex_unlock(&trace_mutex);
+
+	return R_NilValue;
+}
+
+
+static void trace_write_event(FILE *f, const char *name, char phase,
+			      uint64_t ts, long pid, int tid)
+{
+	fprintf(f, ",\n{\"name\": \"%s\", \"cat\": \"corpus\", "
+		"\"ph\": \"%c\", \"ts\": %"PRIu64", "
+		"\"pid\": %ld, \"tid\": %d}", name, phase, ts, pid, tid);
+}
+
+
+// end the open phases on a thread, from the innermost out, down to and
+// including 'stop' (or all of them, if 'stop' is negative)
+static void trace_write_unwind(FILE *f, const int *prev, int *top,
+			       int tid, int stop, uint64_t ts, long pid)
+{
+	int i;
+
+	while ((i = top[tid]) >= 0) {
+		trace_write_event(f, trace_events[i].name, 'E', ts, pid, tid);
+		top[tid] = prev[i];
+		if (i == stop) {
+			break;
+		}
+	}
+}
+
+
+// find the innermost open phase on a thread with the given name
+static int trace_find_open(const int *prev, const int *top, int tid,
+			   const char *name)
+{
+	int i;
+
+	for (i = top[tid]; i >= 0; i = prev[i]) {
+		if (strcmp(trace_events[i].name, name) == 0) {
+			return i;
+		}
+	}
+	return -1;
+}
+
+
+static int trace_write_file(FILE *f)
+{
+	const struct trace_event *e;
+	long pid = (long)getpid();
+	uint64_t *last = NULL;
+	int *prev = NULL, *top = NULL;
+	size_t i;
+	int t, open, err = 0;
+
+	// the open phases on each thread form a stack, linked through 'prev'
+	TRY_ALLOC(prev = corpus_malloc((trace_nevent ? trace_nevent : 1)
+				       * sizeof(*prev)));
+	TRY_ALLOC(top = corpus_malloc((size_t)(trace_nthread + 1)
+				      * sizeof(*top)));
+	TRY_ALLOC(last = corpus_calloc((size_t)(trace_nthread + 1),
+				       sizeof(*last)));
+	for (t = 0; t <= trace_nthread; t++) {
+		top[t] = -1;
+	}
+
+	fprintf(f, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	fprintf(f, "{\"name\": \"process_name\", \"ph\": \"M\", "
+		"\"pid\": %ld, \"tid\": 1, "
+		"\"args\": {\"name\": \"R (corpus)\"}}", pid);
+
+	for (t = 0; t < trace_nthread; t++) {
+		fprintf(f, ",\n{\"name\": \"thread_name\", \"ph\": \"M\", "
+			"\"pid\": %ld, \"tid\": %d, "
+			"\"args\": {\"name\": \"%s %d\"}}", pid, t + 1,
+			t == 0 ? "main" : "worker", t);
+	}
+
+	for (i = 0; i < trace_nevent; i++) {
+		e = &trace_events[i];
+		t = e->tid;
+
+		switch (e->phase) {
+		case 'B':
+			// phases do not nest in themselves; if this one is
+			// still open, an error jumped out of it
+			open = trace_find_open(prev, top, t, e->name);
+			if (open >= 0) {
+				trace_write_unwind(f, prev, top, t, open,
+						   last[t], pid);
+			}
+			trace_write_event(f, e->name, 'B', e->ts, pid, t);
+			prev[i] = top[t];
+			top[t] = (int)i;
+			break;
+
+		case 'E':
+			open = trace_find_open(prev, top, t, e->name);
+			if (open >= 0) {
+				trace_write_unwind(f, prev, top, t, open,
+						   e->ts, pid);
+			}
+			break;
+
+		case 'U':
+			trace_write_unwind(f, prev, top, t, -1, e->ts, pid);
+			break;
+
+		default:
+			break;
+		}
+		last[t] = e->ts;
+	}
+
+	for (t = 0; t <= trace_nthread; t++) {
+		trace_write_unwind(f, prev, top, t, -1, last[t], pid);
+	}
+
+	fprintf(f, "\n]}\n");
+
+	if (ferror(f)) {
+		err = CORPUS_ERROR_OS;
+	}
+out:
+	corpus_free(last);
+	corpus_free(top);
+	corpus_free(prev);
+	return err;
+}
+
+
+SEXP trace_stop(SEXP sfile)
+{
+	const char *file;
+	FILE *f = NULL;
+	int err = 0;
+
+	pthread_mutex_lock(&trace_mutex);
+	rcorpus_trace_enabled = 0;
+	pthread_mutex_unlock(&trace_mutex);
+
+	if (sfile == R_NilValue) {
+		goto out;
+	}
+
+	file = R_ExpandFileName(translateChar(STRING_ELT(sfile, 0)));
+	if (!(f = fopen(file, "w"))) {
+		trace_clear();
+		error("cannot open file '%s' for writing: %s", file,
+		      strerror(errno));
+	}
+
+	err = trace_write_file(f);
+	if (fclose(f) != 0 && !err) {
+		err = CORPUS_ERROR_OS;
+	}
+
+out:
+	trace_clear();
+	CHECK_ERROR_FORMAT(err, "failed writing trace to file '%s'",
+			   translateChar(STRING_ELT(sfile, 0)));
+	return R_NilValue;
+}
@@ -17,6 +17,7 @@
 #include <inttypes.h>
 #include <stdint.h>
 #include <string.h>
+#include <unistd.h>
 #include <Rdefines.h>
 #include "rcorpus.h"
 
@@ -78,3 +79,19 @@ double *as_weights(SEXP sweights, R_xlen_t n)
 
 	return REAL(sweights);
 }
+
+
+// the number of worker threads to use when the caller does not say
+int default_threads(void)
+{
+	long n = 1;
+#ifdef _SC_NPROCESSORS_ONLN
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+	if (n < 1) {
+		n = 1;
+	} else if (n > 64) {
+		n = 64;
+	}
+	return (int)n;
+}